@@ -0,0 +1,240 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "callbacks.h"
+#include "hittable_list.h"
+#include "model.h"
+#include "bvh.h"
+#include "rayset.h"
+#include "scenes.h"
+#include "stats.h"
+#include "ray_sort.h"
+
+#include <iostream>
+#include <iomanip>
+
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_bvh.h>
+
+#include "pathtracer.h"
+
+using namespace std;
+
+/*
+ Replays rays recorded from a real render against every intersection kernel of a scene's objects, one thread,
+ so the kernels can be compared in isolation. Meshes are tested with yocto's bvh, embree and our BVHAccel, one ray
+ at a time and in packets, first in recorded order then sorted by coherence to measure the nodes it saves;
+ the other objects with their own hit().
+
+ record: vren-kernels --scene dragon_scene --record --rays dragon.rays
+ replay: vren-kernels --scene dragon_scene --rays dragon.rays
+*/
+
+struct kernel_params {
+    string scene = "dragon_scene";
+    string rays = "rays.bin";
+    bool record = false;
+    int samples = 4;
+    int resolution = 128;
+    int max_rays = 1 << 20;
+    int repeat = 4;
+    string envmap = "hdrs/large_corridor_4k.exr";
+};
+
+struct kernel_result {
+    double seconds = 0.0;
+    uint64_t rays = 0;
+    uint64_t hits = 0;
+    bool has_traversal = false;
+    traversal_stats traversal;
+};
+
+void parse_cli(kernel_params& params, int argc, const char** argv) {
+    auto cli = yocto::make_cli("vren-kernels", "Intersection Kernels Benchmark");
+    yocto::add_option(cli, "scene", params.scene, "Scene name.");
+    yocto::add_option(cli, "rays", params.rays, "Ray set filename.");
+    yocto::add_option(cli, "record", params.record, "Record the ray set instead of replaying it.");
+    yocto::add_option(cli,
+        "samples", params.samples, "Samples per pixel when recording.", { 1, numeric_limits<int>::max() });
+    yocto::add_option(cli, "resolution", params.resolution, "Image Resolution when recording.", { 1, 4096 });
+    yocto::add_option(cli,
+        "max_rays", params.max_rays, "Maximum rays recorded per kind.", { 1, numeric_limits<int>::max() });
+    yocto::add_option(cli,
+        "repeat", params.repeat, "Number of times each ray set is replayed.", { 1, numeric_limits<int>::max() });
+    yocto::add_option(cli, "envmap", params.envmap, "Environment map used when recording.");
+    yocto::parse_cli(cli, argc, argv);
+}
+
+void record(const kernel_params& params, hittable_list& world, const scene_settings& settings) {
+    unique_ptr<EnvMap> envmap = nullptr;
+    if (!params.envmap.empty()) {
+        envmap = make_unique<EnvMap>(params.envmap);
+    }
+
+    camera cam{ settings.lookfrom, settings.lookat, { 0, 1, 0 }, settings.vfov, 1.0, settings.aperture };
+    auto film = Film(params.resolution, params.resolution);
+    scene_desc scene{ settings.background, world, envmap.get() };
+    pathtracer pt{ cam, film, scene, 500, 3 };
+
+    RaySet set;
+    callback::record_rays cb(set, params.max_rays);
+    yocto::print_progress_begin("Recording rays");
+    pt.Render(params.samples, false, &cb);
+    yocto::print_progress_end();
+
+    for (auto k = 0; k < RaySet::NumKinds; k++) {
+        yocto::print_info(string(RaySet::kindName(k)) + " rays: " + to_string(set.rays[k].size()));
+    }
+    set.saveToFile(params.rays);
+}
+
+template<typename Kernel>
+kernel_result measure(const vector<yocto::ray3f>& rays, int repeat, Kernel&& kernel) {
+    kernel_result result;
+    wall_timer timer;
+    for (auto i = 0; i < repeat; i++) {
+        for (const auto& r : rays) {
+            if (kernel(r)) result.hits++;
+        }
+    }
+    result.seconds = timer.elapsed_seconds();
+    result.rays = rays.size() * repeat;
+    return result;
+}
+
+kernel_result measure_packets(const BVHAccel& accel, const vector<yocto::ray3f>& rays, int repeat) {
+    vector<ray_packet> packets((rays.size() + ray_packet::maxSize - 1) / ray_packet::maxSize);
+    for (auto i = 0; i < rays.size(); i++) {
+        auto& p = packets[i / ray_packet::maxSize];
+        const auto k = p.count++;
+        const auto& r = rays[i];
+        p.ox[k] = r.o.x; p.oy[k] = r.o.y; p.oz[k] = r.o.z;
+        p.dx[k] = r.d.x; p.dy[k] = r.d.y; p.dz[k] = r.d.z;
+        p.tmin[k] = r.tmin;
+        p.tmax[k] = r.tmax;
+    }
+
+    // hit() shrinks tmax, it's restored before every replay
+    auto restore = [&]() {
+        for (auto i = 0; i < rays.size(); i++) packets[i / ray_packet::maxSize].tmax[i % ray_packet::maxSize] = rays[i].tmax;
+    };
+
+    kernel_result result;
+    wall_timer timer;
+    for (auto i = 0; i < repeat; i++) {
+        restore();
+        for (auto& p : packets) accel.hit(p);
+    }
+    result.seconds = timer.elapsed_seconds();
+    result.rays = rays.size() * repeat;
+    for (const auto& p : packets)
+        for (auto k = 0; k < p.count; k++) if (p.element[k] != -1) result.hits += repeat;
+
+    restore();
+    for (auto& p : packets) accel.hit(p, result.traversal);
+    result.has_traversal = true;
+    return result;
+}
+
+void print_header() {
+    cout << left << setw(32) << "object" << setw(10) << "kernel" << setw(10) << "rays"
+        << right << setw(12) << "Mrays/s" << setw(10) << "hit %" << setw(12) << "nodes/ray"
+        << setw(12) << "leaves/ray" << setw(12) << "tris/ray" << "\n";
+}
+
+void print_result(const string& object, const string& kernel, int kind, const kernel_result& r) {
+    cout << left << setw(32) << object.substr(0, 31) << setw(10) << kernel << setw(10) << RaySet::kindName(kind)
+        << right << fixed << setprecision(3)
+        << setw(12) << (r.rays / r.seconds * 1e-6)
+        << setw(10) << setprecision(1) << (100.0 * r.hits / r.rays);
+    if (r.has_traversal) {
+        const double n = (double)r.traversal.rays;
+        cout << setprecision(2) << setw(12) << r.traversal.nodes / n
+            << setw(12) << r.traversal.leaves / n << setw(12) << r.traversal.triangles / n;
+    }
+    else {
+        cout << setw(12) << "-" << setw(12) << "-" << setw(12) << "-";
+    }
+    cout << "\n";
+}
+
+void replay_model(const model& m, const RaySet& set, int repeat) {
+    const auto& scene = m.scene;
+    auto yocto_bvh = yocto::make_bvh(scene, true, false);
+    auto embree_bvh = yocto::make_bvh(scene, true, true);
+    auto accel = BVHAccel::Create(scene.shapes[0], BVHAccel::SplitMethod::SAH);
+
+    for (auto k = 0; k < RaySet::NumKinds; k++) {
+        const auto& rays = set.rays[k];
+        if (rays.empty()) continue;
+
+        print_result(m.name, "yocto", k, measure(rays, repeat, [&](const yocto::ray3f& r) {
+            return yocto::intersect_bvh(yocto_bvh, scene, r).hit;
+            }));
+        print_result(m.name, "embree", k, measure(rays, repeat, [&](const yocto::ray3f& r) {
+            return yocto::intersect_bvh(embree_bvh, scene, r).hit;
+            }));
+
+        yocto::vec2f uv;
+        int element;
+        float dist;
+        auto result = measure(rays, repeat, [&](const yocto::ray3f& r) {
+            return accel->hit(r, uv, element, dist);
+            });
+        // counting in a separate pass keeps it out of the timings
+        for (const auto& r : rays) accel->hit(r, uv, element, dist, result.traversal);
+        result.has_traversal = true;
+        print_result(m.name, "BVHAccel", k, result);
+
+        // packets of rays in recorded order, then sorted by coherence, nodes/ray shows how much they share
+        print_result(m.name, "packet", k, measure_packets(*accel, rays, repeat));
+        vector<int> order(rays.size());
+        for (auto i = 0; i < order.size(); i++) order[i] = i;
+        sortByCoherence(order,
+            [&](int i) { return fromYocto(rays[i].o); },
+            [&](int i) { return fromYocto(rays[i].d); });
+        vector<yocto::ray3f> sorted(rays.size());
+        for (auto i = 0; i < order.size(); i++) sorted[i] = rays[order[i]];
+        print_result(m.name, "sorted", k, measure_packets(*accel, sorted, repeat));
+    }
+}
+
+void replay_hittable(const hittable& h, const RaySet& set, int repeat) {
+    for (auto k = 0; k < RaySet::NumKinds; k++) {
+        const auto& rays = set.rays[k];
+        if (rays.empty()) continue;
+
+        hit_record rec;
+        print_result(h.name, "hit", k, measure(rays, repeat, [&](const yocto::ray3f& r) {
+            return h.hit(ray(fromYocto(r.o), fromYocto(r.d)), r.tmin, r.tmax, rec);
+            }));
+    }
+}
+
+int main(int argc, const char* argv[]) {
+#ifndef NDEBUG
+    yocto::print_info("WARNING! Running in DEBUG mode");
+#endif // !NDEBUG
+
+    kernel_params params{};
+    parse_cli(params, argc, argv);
+
+    hittable_list world;
+    scene_settings settings;
+    if (!load_scene(params.scene, world, settings))
+        yocto::print_fatal("Unknown scene " + params.scene);
+
+    if (params.record) {
+        record(params, world, settings);
+        return 0;
+    }
+
+    RaySet set(params.rays);
+    print_header();
+    for (const auto& object : world.objects) {
+        if (auto m = dynamic_cast<const model*>(object.get()))
+            replay_model(*m, set, params.repeat);
+        else
+            replay_hittable(*object, set, params.repeat);
+    }
+}
@@ -0,0 +1,369 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "scenes.h"
+#include "stats.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+
+#include <yocto/yocto_cli.h>
+
+#include "pathtracer.h"
+#include "embree_scene.h"
+
+using namespace std;
+
+/*
+ Renders the canonical scenes headlessly and reports their performance as JSON.
+ Pixel seeds only depend on the pixel coordinates, so two runs with the same parameters produce the same image
+ whatever the number of threads, and the RMSE against a stored reference only changes when the renderer does.
+*/
+
+struct bench_params {
+    string scenes = "all";
+    int samples = 16;
+    int resolution = 256;
+    int bounces = 500;
+    string envmap = "hdrs/large_corridor_4k.exr";
+    string refs = "refs";
+    bool save_refs = false;
+    string output = "bench.json";
+    bool sort_rays = false;
+    bool embree_scene = false;
+    bool pin_threads = false;
+    bool validate_kernels = false;
+    bool validate_reprojection = false;
+};
+
+struct bench_result {
+    string scene;
+    double load_seconds = 0.0;
+    double bvh_build_seconds = 0.0;
+    double render_seconds = 0.0;
+    render_stats stats;
+    bool has_rmse = false;
+    double rmse = 0.0;
+    bool has_kernels_rmse = false;
+    double kernels_rmse = 0.0; // batched material kernels against the scalar materials
+    bool has_reprojection = false;
+    double reprojected_pixels = 0.0;        // fraction of the film carried over by the camera move
+    double reprojection_depth_error = 0.0;  // median, relative to the depth
+    double reprojection_position_error = 0.0;
+    double reprojection_silhouette_error = 0.0; // fraction of the sphere's carried hits in front of the surface
+};
+
+void parse_cli(bench_params& params, int argc, const char** argv) {
+    auto cli = yocto::make_cli("vren-bench", "Renderer Benchmark");
+    yocto::add_option(cli, "scenes", params.scenes, "Comma separated scene names, or all.");
+    yocto::add_option(cli,
+        "samples", params.samples, "Number of Samples.", { 1, numeric_limits<int>::max() });
+    yocto::add_option(cli, "resolution", params.resolution, "Image Resolution.", { 1, 4096 });
+    yocto::add_option(cli,
+        "bounces", params.bounces, "Number of Bounces.", { 1, numeric_limits<int>::max() });
+    yocto::add_option(cli, "envmap", params.envmap, "Environment map, empty to use the scene's background.");
+    yocto::add_option(cli, "refs", params.refs, "Folder of the <scene>.raw reference images.");
+    yocto::add_option(cli, "save_refs", params.save_refs, "Save the renders as the new references.");
+    yocto::add_option(cli, "output", params.output, "JSON report filename.");
+    yocto::add_option(cli, "sort_rays", params.sort_rays, "Sort secondary rays by coherence before intersecting them.");
+    yocto::add_option(cli, "embree_scene", params.embree_scene, "Intersect each scene with a single Embree scene.");
+    yocto::add_option(cli, "pin_threads", params.pin_threads, "Pin render threads to cores and place the film on their NUMA nodes.");
+    yocto::add_option(cli, "validate_kernels", params.validate_kernels,
+        "Render again with the scalar materials and compare the images.");
+    yocto::add_option(cli, "validate_reprojection", params.validate_reprojection,
+        "Orbit the camera and check that the film's first hits move to the pixels that see them.");
+    yocto::parse_cli(cli, argc, argv);
+}
+
+vector<string> split_scenes(const string& names) {
+    if (names == "all") return scene_names;
+
+    vector<string> scenes;
+    stringstream ss(names);
+    string name;
+    while (getline(ss, name, ',')) {
+        if (!name.empty()) scenes.push_back(name);
+    }
+    return scenes;
+}
+
+// first hit of the ray through (x + dx, y + dy) of film pixel (x, y), from the center of the lens
+bool pixel_hit(const camera& cam, const hittable& world, const Film& film, int x, int y, double dx, double dy,
+        hit_record& rec) {
+    const int j = (film.height - 1) - y;
+    const ray r(cam.getLookFrom(), cam.get_direction((x + dx) / (film.width - 1), (j + dy) / (film.height - 1)));
+    return world.hit(r, 0.001, infinity, rec);
+}
+
+bool center_hit(const camera& cam, const hittable& world, const Film& film, int x, int y, hit_record& rec) {
+    return pixel_hit(cam, world, film, x, y, 0.5, 0.5, rec);
+}
+
+double median(vector<double> values) {
+    if (values.empty()) return 0.0;
+    auto middle = values.begin() + values.size() / 2;
+    nth_element(values.begin(), middle, values.end());
+    return *middle;
+}
+
+struct reprojection_errors {
+    double carried = 0.0;   // fraction of the film carried over by the camera move
+    double depth = 0.0;     // median, relative to the depth
+    double position = 0.0;
+    double closer = 0.0;    // fraction of the carried hits in front of the surface their pixel sees
+};
+
+/*
+ Renders the first hits of subpixels x subpixels rays per pixel into the film's depth, with the pixel's coordinates
+ as its color, then orbits the camera around its target and reprojects the film. Each carried pixel should hold the
+ hit its own center ray sees, within a pixel, at the same distance.
+ The errors are the medians of the relative depth difference and of the distance between both hits over the depth
+*/
+reprojection_errors reproject_orbit(const camera& cam, const scene_desc& scene, const bench_params& params, int subpixels) {
+    camera moved = cam;
+    auto film = Film(params.resolution, params.resolution);
+    pathtracer pt{ moved, film, scene, (unsigned)params.bounces, 3 };
+    pt.SetReprojection(true);
+
+    const int width = film.width;
+    const int height = film.height;
+    vector<point3> hits(width * height);
+    for (auto y = 0; y < height; y++) {
+        for (auto x = 0; x < width; x++) {
+            hit_record rec;
+            if (center_hit(moved, scene.world, film, x, y, rec)) hits[y * width + x] = rec.p;
+            aov_sample sum;
+            for (auto k = 0; k < subpixels * subpixels; k++) {
+                aov_sample aov;
+                const double dx = (k % subpixels + 0.5) / subpixels;
+                const double dy = (k / subpixels + 0.5) / subpixels;
+                if (pixel_hit(moved, scene.world, film, x, y, dx, dy, rec)) {
+                    aov.depth = (float)rec.t;
+                    aov.hits = 1;
+                }
+                sum.add(aov);
+            }
+            film.AddSample(x, y, { (float)x, (float)y, 1.0f });
+            film.AddAOVs(x, y, sum, subpixels * subpixels);
+        }
+    }
+
+    const point3 at = moved.getLookAt();
+    const vec3 offset = moved.getLookFrom() - at;
+    const double angle = degrees_to_radians(5.0);
+    const point3 from = at + vec3(
+        offset.x() * std::cos(angle) + offset.z() * std::sin(angle),
+        offset.y(),
+        offset.z() * std::cos(angle) - offset.x() * std::sin(angle));
+    pt.updateCamera(from.x(), from.y(), from.z(), at.x(), at.y(), at.z());
+
+    vector<yocto::vec4f> sources(width * height);
+    film.GetLinear(sources.data());
+    vector<yocto::vec3f> albedo, normal;
+    vector<float> depth;
+    film.GetGuides(albedo, normal, depth);
+
+    vector<double> depthErrors, positionErrors;
+    int carried = 0, carriedHits = 0, closer = 0;
+    for (auto y = 0; y < height; y++) {
+        for (auto x = 0; x < width; x++) {
+            const auto idx = y * width + x;
+            // blue is only set on the carried pixels
+            if (sources[idx].z < 0.5f) continue;
+            carried++;
+            hit_record rec;
+            const bool hit = center_hit(moved, scene.world, film, x, y, rec);
+            if (depth[idx] > 0.0f) {
+                carriedHits++;
+                // a hit that lands in front of the surface its new pixel sees hides it
+                if (hit && depth[idx] < rec.t * 0.9) closer++;
+            }
+            if (!hit) continue;
+            const auto source = lround(sources[idx].y) * width + lround(sources[idx].x);
+            depthErrors.push_back(std::abs(depth[idx] - rec.t) / rec.t);
+            positionErrors.push_back((hits[source] - rec.p).length() / rec.t);
+        }
+    }
+
+    reprojection_errors errors;
+    errors.carried = (double)carried / (width * height);
+    errors.depth = median(depthErrors);
+    errors.position = median(positionErrors);
+    errors.closer = carriedHits > 0 ? (double)closer / carriedHits : 0.0;
+    return errors;
+}
+
+// reprojects the scene, then a sphere in front of the sky whose silhouette pixels mix hits and misses
+void validate_reprojection(const camera& cam, const scene_desc& scene, const bench_params& params, bench_result& result) {
+    const auto errors = reproject_orbit(cam, scene, params, 1);
+    result.has_reprojection = true;
+    result.reprojected_pixels = errors.carried;
+    result.reprojection_depth_error = errors.depth;
+    result.reprojection_position_error = errors.position;
+
+    hittable_list world;
+    world.add(make_shared<sphere>("sphere", point3(0, 0, 0), 1.0, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    const scene_desc sky{ color(0.7, 0.8, 1.0), world, nullptr };
+    const camera front{ point3(0, 0, 5), point3(0, 0, 0), { 0, 1, 0 }, 30.0, 1.0, 0.0 };
+    result.reprojection_silhouette_error = reproject_orbit(front, sky, params, 4).closer;
+}
+
+bench_result run_scene(const string& name, const bench_params& params, EnvMap* envmap) {
+    bench_result result;
+    result.scene = name;
+
+    hittable_list world;
+    scene_settings settings;
+    const double bvh_seconds = total_bvh_build_seconds;
+    wall_timer timer;
+    if (!load_scene(name, world, settings))
+        yocto::print_fatal("Unknown scene " + name);
+    unique_ptr<embree_scene> accel = nullptr;
+    if (params.embree_scene) accel = make_unique<embree_scene>(world);
+    result.load_seconds = timer.elapsed_seconds();
+    result.bvh_build_seconds = total_bvh_build_seconds - bvh_seconds;
+
+    const auto aspect_ratio = 1.0;
+    camera cam{ settings.lookfrom, settings.lookat, { 0, 1, 0 }, settings.vfov, aspect_ratio, settings.aperture };
+    auto film = Film(params.resolution, params.resolution);
+    scene_desc scene{ settings.background, accel ? (hittable&)*accel : world, envmap };
+    pathtracer pt{ cam, film, scene, (unsigned)params.bounces, 3 };
+    pt.SetRaySorting(params.sort_rays);
+    if (params.pin_threads) pt.PinThreads();
+
+    yocto::print_progress_begin("Rendering " + name, params.samples);
+    timer.reset();
+    for (auto i : yocto::range(params.samples)) {
+        pt.Render(1, true, nullptr);
+        yocto::print_progress_next();
+    }
+    result.render_seconds = timer.elapsed_seconds();
+    result.stats = pt.GetStats();
+
+    RawData raw(film.width, film.height);
+    film.GetRaw(raw);
+
+    if (params.validate_kernels) {
+        auto scalar_film = Film(params.resolution, params.resolution);
+        pathtracer scalar_pt{ cam, scalar_film, scene, (unsigned)params.bounces, 3 };
+        scalar_pt.SetRaySorting(params.sort_rays);
+        scalar_pt.SetBatchedShading(false);
+        yocto::print_progress_begin("Validating " + name, params.samples);
+        for (auto i : yocto::range(params.samples)) {
+            scalar_pt.Render(1, true, nullptr);
+            yocto::print_progress_next();
+        }
+        RawData scalar_raw(scalar_film.width, scalar_film.height);
+        scalar_film.GetRaw(scalar_raw);
+        result.kernels_rmse = raw.rmse(scalar_raw);
+        result.has_kernels_rmse = true;
+    }
+
+    if (params.validate_reprojection) {
+        validate_reprojection(cam, scene, params, result);
+        // a carried hit is at most a pixel away from the one its pixel sees
+        if (result.reprojection_position_error > 0.01 || result.reprojection_depth_error > 0.01)
+            yocto::print_info("WARNING! " + name + ": reprojected hits are misplaced, depth error " +
+                to_string(result.reprojection_depth_error) + ", position error " + to_string(result.reprojection_position_error));
+        // only pixels whose samples all hit the sphere are carried, they can't land in front of it
+        if (result.reprojection_silhouette_error > 0.0)
+            yocto::print_info("WARNING! " + name + ": reprojected silhouettes cover the surfaces behind them, error " +
+                to_string(result.reprojection_silhouette_error));
+    }
+
+    const auto ref_filename = params.refs + "/" + name + ".raw";
+    if (params.save_refs) {
+        raw.saveToFile(ref_filename);
+    }
+    else if (ifstream(ref_filename).good()) {
+        try {
+            result.rmse = raw.rmse(RawData(ref_filename));
+            result.has_rmse = true;
+        }
+        catch (const std::invalid_argument& e) {
+            yocto::print_info("WARNING! " + ref_filename + ": " + e.what());
+        }
+    }
+
+    return result;
+}
+
+void save_report(const string& filename, const bench_params& params, const vector<bench_result>& results) {
+    ofstream out(filename);
+    if (!out)
+        yocto::print_fatal("Failed to create " + filename);
+
+    out << "{\n";
+    out << "  \"samples\": " << params.samples << ",\n";
+    out << "  \"resolution\": " << params.resolution << ",\n";
+    out << "  \"bounces\": " << params.bounces << ",\n";
+    out << "  \"sort_rays\": " << (params.sort_rays ? "true" : "false") << ",\n";
+    out << "  \"embree_scene\": " << (params.embree_scene ? "true" : "false") << ",\n";
+    out << "  \"pin_threads\": " << (params.pin_threads ? "true" : "false") << ",\n";
+    out << "  \"threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"scenes\": [\n";
+    for (auto i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << "    {\n";
+        out << "      \"name\": \"" << r.scene << "\",\n";
+        out << "      \"load_seconds\": " << r.load_seconds << ",\n";
+        out << "      \"bvh_build_seconds\": " << r.bvh_build_seconds << ",\n";
+        out << "      \"render_seconds\": " << r.render_seconds << ",\n";
+        out << "      \"paths\": " << r.stats.paths << ",\n";
+        out << "      \"rays\": " << r.stats.rays << ",\n";
+        out << "      \"average_path_depth\": " << (r.stats.paths > 0 ? (double)r.stats.bounces / r.stats.paths : 0.0) << ",\n";
+        out << "      \"paths_per_second\": " << r.stats.paths / r.render_seconds << ",\n";
+        out << "      \"mrays_per_second\": " << r.stats.rays / r.render_seconds * 1e-6 << ",\n";
+#ifdef VREN_BVH_STATS
+        const auto& t = r.stats.traversal;
+        out << "      \"bvh_rays\": " << t.rays << ",\n";
+        out << "      \"bvh_nodes\": " << t.nodes << ",\n";
+        out << "      \"bvh_leaves\": " << t.leaves << ",\n";
+        out << "      \"bvh_triangles\": " << t.triangles << ",\n";
+        out << "      \"bvh_max_stack\": " << t.max_stack << ",\n";
+#endif
+        if (r.has_kernels_rmse) out << "      \"kernels_rmse\": " << r.kernels_rmse << ",\n";
+        if (r.has_reprojection) {
+            out << "      \"reprojected_pixels\": " << r.reprojected_pixels << ",\n";
+            out << "      \"reprojection_depth_error\": " << r.reprojection_depth_error << ",\n";
+            out << "      \"reprojection_position_error\": " << r.reprojection_position_error << ",\n";
+            out << "      \"reprojection_silhouette_error\": " << r.reprojection_silhouette_error << ",\n";
+        }
+        out << "      \"rmse\": ";
+        if (r.has_rmse) out << r.rmse << "\n";
+        else out << "null\n";
+        out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+int main(int argc, const char* argv[]) {
+#ifndef NDEBUG
+    yocto::print_info("WARNING! Running in DEBUG mode");
+#endif // !NDEBUG
+
+    bench_params params{};
+    parse_cli(params, argc, argv);
+
+    unique_ptr<EnvMap> envmap = nullptr;
+    if (!params.envmap.empty()) {
+        envmap = make_unique<EnvMap>(params.envmap);
+    }
+
+    vector<bench_result> results;
+    for (const auto& name : split_scenes(params.scenes)) {
+        results.push_back(run_scene(name, params, envmap.get()));
+        const auto& r = results.back();
+        yocto::print_info(name + ": " + to_string(r.render_seconds) + "s, " +
+            to_string(r.stats.rays / r.render_seconds * 1e-6) + " Mrays/s, " +
+            to_string(r.stats.paths / r.render_seconds) + " paths/s");
+    }
+
+    save_report(params.output, params, results);
+}
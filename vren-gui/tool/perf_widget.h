@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <cstdio>
+#include <cfloat>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+#include "imguiManager.h"
+#include "stats.h"
+#include "profiler.h"
+
+namespace tool {
+    // resident memory of the process in bytes, 0 where it isn't supported
+    inline size_t residentMemoryBytes() {
+#if defined(__linux__)
+        size_t pages = 0, resident = 0;
+        FILE* f = fopen("/proc/self/statm", "r");
+        if (!f) return 0;
+        const bool read = fscanf(f, "%zu %zu", &pages, &resident) == 2;
+        fclose(f);
+        return read ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#elif defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#else
+        return 0;
+#endif
+    }
+
+    /*
+     Live throughput of the path tracer. The window feeds it the tracer's counters every frame, the rates are
+     measured over the last interval only so they follow scene and parameter changes right away.
+    */
+    class PerfWidget : public Widget {
+    private:
+        static constexpr double interval = 0.5; // seconds
+        static const int historySize = 120;
+
+        wall_timer timer;
+        render_stats last;
+        unsigned lastPasses = 0;
+        std::vector<double> lastStages;
+
+        // measured over the last interval
+        double sppPerSecond = 0.0; // full film passes, the focus region gets more samples than this
+        double pathsPerSecond = 0.0;
+        double raysPerSecond = 0.0;
+        double averageDepth = 0.0;
+        double utilization = 0.0; // fraction of the render threads' time spent rendering
+        unsigned threads = 1;
+        std::vector<double> stageShare; // percentage of the path time, empty without VREN_PROFILER
+        size_t memory = 0;
+        std::vector<float> history; // Mrays/s of the last intervals
+
+    public:
+        // stats are the tracer's counters since its last Reset(), passes the completed passes since the last camera
+        // change, stages the profiler's cumulated stage seconds
+        void update(const render_stats& stats, unsigned numThreads, unsigned passes, const std::vector<double>& stages) {
+            const double elapsed = timer.elapsed_seconds();
+            if (elapsed < interval) return;
+            timer.reset();
+
+            // the counters went back to zero when the tracer was reset during the interval
+            const render_stats base = stats.paths < last.paths ? render_stats{} : last;
+            const double paths = (double)(stats.paths - base.paths);
+            pathsPerSecond = paths / elapsed;
+            // paths / pixels would count the extra samples of the focus region as progress of the whole film
+            sppPerSecond = (passes - (passes < lastPasses ? 0 : lastPasses)) / elapsed;
+            lastPasses = passes;
+            raysPerSecond = (stats.rays - base.rays) / elapsed;
+            if (paths > 0) averageDepth = (stats.bounces - base.bounces) / paths;
+            threads = std::max(numThreads, 1u);
+            utilization = std::min((stats.busy_seconds - base.busy_seconds) / (elapsed * threads), 1.0);
+
+            stageShare.clear();
+            if (stages.size() == lastStages.size() && stages.size() == profiler::NumStages) {
+                const double path = stages[profiler::Path] - lastStages[profiler::Path];
+                for (auto s = 0; s < profiler::NumStages; s++)
+                    stageShare.push_back(path > 0.0 ? 100.0 * (stages[s] - lastStages[s]) / path : 0.0);
+            }
+            lastStages = stages;
+            last = stats;
+
+            memory = residentMemoryBytes();
+
+            history.push_back((float)(raysPerSecond * 1e-6));
+            if (history.size() > historySize) history.erase(history.begin());
+        }
+
+        virtual void Render() override {
+            ImGui::Begin("Performance");
+            ImGui::Text("%.3f spp/s", sppPerSecond);
+            ImGui::Text("%.0f paths/s", pathsPerSecond);
+            ImGui::Text("%.2f Mrays/s", raysPerSecond * 1e-6);
+            if (!history.empty())
+                ImGui::PlotLines("##mrays", history.data(), (int)history.size(), 0, "Mrays/s", 0.0f, FLT_MAX, ImVec2(220, 60.0f));
+            ImGui::Text("average path depth %.2f", averageDepth);
+
+            char overlay[32];
+            snprintf(overlay, sizeof(overlay), "%.0f%% of %u threads", utilization * 100.0, threads);
+            ImGui::ProgressBar((float)utilization, ImVec2(220, 0.0f), overlay);
+
+            if (stageShare.empty()) {
+                ImGui::TextDisabled("stage times need VREN_PROFILER");
+            }
+            else {
+                // path is the whole path, the other stages are the part of it they take
+                for (int s = profiler::Intersect; s < profiler::NumStages; s++)
+                    ImGui::Text("%-10s %5.1f%%", profiler::stageName(s), stageShare[s]);
+            }
+
+            ImGui::Text("memory %.1f MB", memory / (1024.0 * 1024.0));
+            ImGui::End();
+        }
+    };
+}
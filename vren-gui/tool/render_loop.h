@@ -0,0 +1,224 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <glm/glm.hpp>
+
+#include "tracer.h"
+#include "profiler.h"
+#include "screen_texture.h"
+
+namespace tool {
+    /*
+     Renders one pass after the other on its own thread, so the UI thread only uploads the latest snapshot of the film
+     and its frame rate doesn't depend on how long a pass takes.
+     Camera changes cancel the running pass through its render_job, they are applied before the next one.
+     With a preview size, the passes that follow a camera change render one sample per block of pixels, until one of
+     them completes without the camera moving again. The film is then reset and rendered at full resolution.
+     With reprojection, camera changes keep the samples that are still visible and there is no preview.
+    */
+    class render_loop {
+    private:
+        tracer& pt;
+        screen_texture& screen;
+        callback::callback* cb;
+        const int maxSamples; // -1 renders forever
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::shared_ptr<render_job> job;
+        bool quit = false;
+        bool paused = true;
+        bool busy = false; // a pass is running, or its snapshot is being taken
+
+        bool cameraChanged = false;
+        glm::vec3 lookFrom, lookAt;
+
+        int previewSize = 1;
+        bool previewing = false; // only used by the render thread
+
+        bool reproject = false;
+        bool reprojectChanged = false;
+
+        // film pixels rendered first, see tracer::SetFocus()
+        int focusX0 = 0, focusY0 = 0, focusX1 = 0, focusY1 = 0;
+        unsigned focusBoost = 1;
+
+        std::atomic<unsigned> numSamples{ 0 };
+
+        // profiler::registry::stageSeconds() after the last pass, empty without VREN_PROFILER
+        std::vector<double> stages;
+
+        bool canRender() const {
+            return !paused && (cameraChanged || maxSamples < 0 || numSamples < (unsigned)maxSamples);
+        }
+
+        void run() {
+            while (true) {
+                // the changes are copied under the lock and applied to the tracer without it, updateCamera() can
+                // reproject the whole film and SetPreview() waits for the previous pass, the UI thread mustn't wait on them
+                bool applyReprojection = false, reprojection = false;
+                bool applyCamera = false;
+                glm::vec3 from, at;
+                int preview = 1;
+                int x0, y0, x1, y1;
+                unsigned boost;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    job = nullptr;
+                    busy = false;
+                    cv.notify_all();
+                    cv.wait(lock, [this] { return quit || canRender(); });
+                    if (quit) return;
+
+                    busy = true;
+                    applyReprojection = reprojectChanged;
+                    reprojection = reproject;
+                    reprojectChanged = false;
+                    if (cameraChanged) {
+                        applyCamera = true;
+                        from = lookFrom;
+                        at = lookAt;
+                        numSamples = 0;
+                        cameraChanged = false;
+                        previewing = previewSize > 1 && !reproject;
+                        preview = previewing ? previewSize : 1;
+                    }
+                    x0 = focusX0;
+                    y0 = focusY0;
+                    x1 = focusX1;
+                    y1 = focusY1;
+                    boost = focusBoost;
+                }
+
+                if (applyReprojection) pt.SetReprojection(reprojection);
+                if (applyCamera) {
+                    pt.updateCamera(from.x, from.y, from.z, at.x, at.y, at.z);
+                    pt.SetPreview(preview);
+                }
+                pt.SetFocus(x0, y0, x1, y1, boost);
+                // callbacks aren't thread safe, render the pass on a single thread when there is one
+                auto pass = pt.RenderAsync(1, !cb, cb);
+                {
+                    const std::lock_guard<std::mutex> lock(mutex);
+                    job = pass;
+                    // changes made while the pass was set up couldn't cancel it
+                    if (quit || cameraChanged || !canRender()) pass->Cancel();
+                }
+
+                pass->Wait();
+#ifdef VREN_PROFILER
+                {
+                    // the render threads are idle until this thread starts the next pass
+                    auto seconds = profiler::registry::get().stageSeconds();
+                    const std::lock_guard<std::mutex> lock(mutex);
+                    stages = std::move(seconds);
+                }
+#endif
+                if (!pass->IsComplete()) continue;
+
+                screen.snapshot();
+                if (previewing) {
+                    // the camera stopped moving, the preview stays on screen until the first full pass is done
+                    bool stopped;
+                    {
+                        const std::lock_guard<std::mutex> lock(mutex);
+                        stopped = !cameraChanged;
+                    }
+                    // a camera change from now on is applied by the next pass, which resets the film anyway
+                    if (stopped) {
+                        previewing = false;
+                        pt.SetPreview(1);
+                        pt.Reset();
+                    }
+                    continue;
+                }
+                numSamples++;
+                std::cerr << "\riteration " << numSamples << std::flush;
+            }
+        }
+
+    public:
+        render_loop(tracer& pt, screen_texture& screen, int maxSamples, callback::callback* cb = nullptr) :
+            pt(pt), screen(screen), cb(cb), maxSamples(maxSamples) {
+            thread = std::thread(&render_loop::run, this);
+        }
+
+        ~render_loop() {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+                if (job) job->Cancel();
+            }
+            cv.notify_all();
+            thread.join();
+        }
+
+        // cancels the running pass and waits for the tracer to be idle, so it can be used from this thread
+        void pause() {
+            std::unique_lock<std::mutex> lock(mutex);
+            paused = true;
+            if (job) job->Cancel();
+            cv.wait(lock, [this] { return !busy; });
+        }
+
+        void resume() {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                paused = false;
+            }
+            cv.notify_all();
+        }
+
+        // the running pass is dropped, the tracer is updated and reset before the next one
+        void updateCamera(glm::vec3 look_from, glm::vec3 look_at) {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                lookFrom = look_from;
+                lookAt = look_at;
+                cameraChanged = true;
+                if (job) job->Cancel();
+            }
+            cv.notify_all();
+        }
+
+        // size of the preview blocks after a camera change, 1 disables the preview
+        void setPreview(int size) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            previewSize = size;
+        }
+
+        // applied when the next pass starts, see tracer::SetReprojection()
+        void setReprojection(bool enabled) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (enabled == reproject) return;
+            reproject = enabled;
+            reprojectChanged = true;
+        }
+
+        // applied when the next pass starts, an empty rectangle clears the focus
+        void setFocus(int x0, int y0, int x1, int y1, unsigned boost) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            focusX0 = x0;
+            focusY0 = y0;
+            focusX1 = x1;
+            focusY1 = y1;
+            focusBoost = boost;
+        }
+
+        std::vector<double> stageSeconds() {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return stages;
+        }
+
+        // completed passes since the last camera change
+        unsigned samples() const { return numSamples; }
+
+        bool isDone() const { return maxSamples >= 0 && numSamples >= (unsigned)maxSamples; }
+    };
+}
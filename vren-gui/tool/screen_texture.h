@@ -2,8 +2,10 @@
 
 #include <glad/glad.h>  // include glad.h to get all required OpenGL headers
 #include <yocto/yocto_image.h>
+#include <mutex>
 
 #include "Film.h"
+#include "thread_pool.hpp"
 #include "shader.h"
 
 namespace tool {
@@ -13,13 +15,16 @@ namespace tool {
         unsigned texture;
         unsigned VBO, VAO, EBO;
 
-        const Film& film;
-        yocto::color_image image;
+        Film& film;
+        thread_pool pool;
 
-    public:
-        screen_texture(const Film& film) : film(film) {
-            image = yocto::make_image(film.width, film.height, false);
+        // resolved film, snapshot() resolves the tiles that changed and upload() sends them to the texture
+        std::mutex bytesMutex;
+        std::vector<yocto::vec4b> bytes;
+        std::vector<film_rect> dirtyRects; // resolved but not uploaded yet
 
+    public:
+        screen_texture(Film& film) : film(film), bytes(film.width * film.height) {
             float vertices[] = {
                 // position           // texture coords
                 +1.0f, +1.0f,  0.0f,  1.0f, 0.0f,
@@ -62,6 +67,8 @@ namespace tool {
             // set texture filtering parameters
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            // allocated once, upload() only updates the tiles that changed
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, film.width, film.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 
             updateScreen();
 
@@ -77,15 +84,43 @@ namespace tool {
         }
 
         void updateScreen() {
-            vector<yocto::vec4b> bytes;
-            film.GetImage(image);
-            yocto::float_to_byte(bytes, image.pixels);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &bytes[0]);
+            snapshot();
+            upload();
+        }
+
+        // resolves the tiles of the film that changed, can be called from any thread but only one at a time
+        void snapshot() {
+            const std::lock_guard<std::mutex> lock(bytesMutex);
+            film.ResolveDirty(bytes.data(), dirtyRects, &pool);
+        }
+
+        // uploads the tiles resolved since the last upload, must be called from the GL thread
+        void upload() {
+            const std::lock_guard<std::mutex> lock(bytesMutex);
+            if (dirtyRects.empty()) return;
+
+            glBindTexture(GL_TEXTURE_2D, texture);
+            size_t dirtyPixels = 0;
+            for (const auto& r : dirtyRects) dirtyPixels += (size_t)(r.x1 - r.x0) * (r.y1 - r.y0);
+            if (dirtyPixels * 2 > bytes.size()) {
+                // a single upload is cheaper once most of the film changed
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, film.width, film.height, GL_RGBA, GL_UNSIGNED_BYTE, bytes.data());
+            }
+            else {
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, film.width);
+                for (const auto& r : dirtyRects) {
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &bytes[r.y0 * film.width + r.x0]);
+                }
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            }
+            dirtyRects.clear();
         }
 
         glm::vec3 get_color(unsigned x, unsigned y) {
-            yocto::vec4f color = yocto::get_pixel(image, x, y);
-            return glm::vec3(color.x, color.y, color.z);
+            const std::lock_guard<std::mutex> lock(bytesMutex);
+            const auto& color = bytes[y * film.width + x];
+            return glm::vec3(color.x, color.y, color.z) / 255.0f;
         }
 
         void render() {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <callbacks.h>
+#include <path_recorder.h>
 #include <vector>
 
 #include "tracer_data.h"
@@ -24,6 +24,15 @@ namespace tool {
     public:
         bool preview = false;
         int previewSize = 5;
+        // renders the tiles around the mouse, or around the rectangle dragged with the right button, first
+        bool focus = false;
+        int focusRadius = 64;
+        int focusBoost = 4;
+        // camera moves keep the samples that are still visible
+        bool reproject = false;
+
+        // the camera moves without leaving the path tracer
+        bool navigates() const { return preview || reproject; }
 
         virtual void Render() override {
             ImGui::Begin("Render Settings");
@@ -31,6 +40,12 @@ namespace tool {
             if (preview) {
                 ImGui::SliderInt("preview size", &previewSize, 1, 101);
             }
+            ImGui::Checkbox("focus", &focus);
+            if (focus) {
+                ImGui::SliderInt("focus radius", &focusRadius, 8, 512);
+                ImGui::SliderInt("focus samples", &focusBoost, 1, 16);
+            }
+            ImGui::Checkbox("reproject", &reproject);
             ImGui::End();
         }
     };
@@ -84,6 +84,10 @@ namespace tool {
         glfwSetScrollCallback(glwindow, scroll_callback);
 
         // Setup UI widgets
+        renderMode = make_shared<RenderModeWidget>();
+        imGuiManager->addWidget(renderMode);
+        perf = make_shared<PerfWidget>();
+        imGuiManager->addWidget(perf);
     }
 
     window::~window() {
@@ -95,6 +99,10 @@ namespace tool {
     }
 
     void window::render(int spp) {
+        // path tracing runs on its own thread, this loop only displays its latest snapshot
+        renderer = make_unique<render_loop>(*pt, *screen, spp, cb);
+        if (state == WindowState::PathTracer) renderer->resume();
+
         // render loop
         // -----------
         while (!glfwWindowShouldClose(glwindow)) {
@@ -109,14 +117,15 @@ namespace tool {
 
             // render our instances
             if (state == WindowState::PathTracer) {
-                isRendering = spp == -1 || numSamples < spp;
-                if (isRendering) {
-                    // disable parallel rendering if cb defined
-                    pt->Render(1, !cb, cb);
-                    numSamples++;
-                    std::cerr << "\riteration " << numSamples << std::flush;
-                    screen->updateScreen();
-                }
+                renderer->setPreview(renderMode->preview ? renderMode->previewSize : 1);
+                renderer->setReprojection(renderMode->reproject);
+                // in preview or reprojection mode the camera moves without leaving the path tracer
+                if (cam.getChangedAndReset()) renderer->updateCamera(cam.getLookFrom(), cam.getLookAt());
+                updateFocus();
+                perf->update(pt->GetStats(), pt->GetThreadCount(), renderer->samples(), renderer->stageSeconds());
+
+                isRendering = !renderer->isDone();
+                screen->upload();
                 screen->render();
                 if (!isRendering && pixel) pixel->render();
             } else {
@@ -136,6 +145,8 @@ namespace tool {
             glfwSwapBuffers(glwindow);
             glfwPollEvents();
         }
+
+        renderer.reset();
     }
 
     void window::switchToPathTracer(bool force = false) {
@@ -145,14 +156,38 @@ namespace tool {
             if (cam.getChangedAndReset()) {
                 auto from = cam.getLookFrom();
                 auto at = cam.getLookAt();
-                pt->updateCamera(from.x, from.y, from.z, at.x, at.y, at.z);
+                if (renderer)
+                    renderer->updateCamera(from, at);
+                else
+                    pt->updateCamera(from.x, from.y, from.z, at.x, at.y, at.z);
             }
+            if (renderer) renderer->resume();
+        }
+    }
+
+    void window::updateFocus() {
+        if (!renderMode->focus) {
+            renderer->setFocus(0, 0, 0, 0, 1);
+            return;
+        }
+
+        if (has_focus_rect || focus_dragging) {
+            auto lo = glm::min(focus_start, focus_end);
+            auto hi = glm::max(focus_start, focus_end);
+            renderer->setFocus((int)lo.x, (int)lo.y, (int)hi.x + 1, (int)hi.y + 1, renderMode->focusBoost);
+        }
+        else {
+            const int r = renderMode->focusRadius;
+            const int x = (int)mouse_last_x;
+            const int y = (int)mouse_last_y;
+            renderer->setFocus(x - r, y - r, x + r, y + r, renderMode->focusBoost);
         }
     }
 
     void window::switchToWireFrame(bool force = false) {
         if (force || state != WindowState::WireFrame) {
             state = WindowState::WireFrame;
+            if (renderer) renderer->pause();
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
             glEnable(GL_CULL_FACE);
         }
@@ -168,6 +203,8 @@ namespace tool {
             }
         }
 
+        if (focus_dragging) focus_end = glm::vec2(xPos, yPos);
+
         cam.handle_mouse_move(xPos, yPos);
         mouse_last_x = xPos;
         mouse_last_y = yPos;
@@ -177,8 +214,25 @@ namespace tool {
         if (imGuiManager->wantCaptureMouse()) return;
 
         if (state == WindowState::PathTracer) {
+            if (renderMode->focus && button == GLFW_MOUSE_BUTTON_2) {
+                // a click without dragging goes back to following the mouse
+                if (action == GLFW_PRESS) {
+                    focus_dragging = true;
+                    focus_start = focus_end = glm::vec2(mouse_last_x, mouse_last_y);
+                }
+                else if (action == GLFW_RELEASE) {
+                    focus_dragging = false;
+                    has_focus_rect = focus_start != focus_end;
+                }
+                return;
+            }
+            if (renderMode->navigates()) {
+                cam.handle_mouse_buttons(button, action, mods);
+                return;
+            }
             if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_1) {
                 if (canDebugPixels) {
+                    unsigned numSamples = renderer ? renderer->samples() : 0;
                     unsigned spp = numSamples == 0 ? 1 : numSamples;
                     debugPixel(mouse_last_x, mouse_last_y, spp);
                 }
@@ -191,33 +245,35 @@ namespace tool {
     }
 
     void window::debugPixel(unsigned x, unsigned y, unsigned spp) {
-        // generate render paths
+        // the tracer can't render while pixels are debugged
+        if (renderer) renderer->pause();
+
+        // render the pixel once, then replay its paths to build the segments, collect the hits and print them
+        auto recorder = std::make_unique<callback::path_recorder>();
+        pt->DebugPixel(x, y, spp, recorder.get());
+
         //auto buildSegmentsCb = std::make_shared<callback::in_out_segments_cb>();
         auto buildSegmentsCb = std::make_shared<callback::build_segments_cb>();
         auto collectHitsCb = std::make_shared<callback::collect_hits>();
         auto multiCb = std::make_unique<callback::multi>();
         multiCb->add(buildSegmentsCb);
         multiCb->add(collectHitsCb);
+        multiCb->add(std::make_shared<callback::print_callback>(true));
 
-        pt->DebugPixel(x, y, spp, multiCb.get());
+        recorder->replay(*multiCb);
 
         hits = collectHitsCb->hits;
 
         if (ls) ls.reset();
         ls = make_unique<lines>(buildSegmentsCb->segments);
 
-        {
-            auto pcb = std::make_unique<callback::print_callback>(true);
-            pt->DebugPixel(x, y, spp, pcb.get());
-        }
-
         switchToWireFrame();
     }
 
     void window::handle_mouse_scroll(double xoffset, double yoffset) {
         if (imGuiManager->wantCaptureMouse()) return;
 
-        if (state != WindowState::PathTracer) {
+        if (state != WindowState::PathTracer || renderMode->navigates()) {
             cam.handle_mouse_scroll(xoffset, yoffset);
         }
     }
@@ -17,6 +17,8 @@
 #include "lines.h"
 #include "tracer.h"
 #include "widgets.h"
+#include "perf_widget.h"
+#include "render_loop.h"
 
 namespace tool {
     enum WindowState {
@@ -32,6 +34,12 @@ namespace tool {
         double mouse_last_x = 0.0f;
         double mouse_last_y = 0.0f;
 
+        // rectangle dragged with the right button in the path tracer, used as focus instead of the mouse
+        bool focus_dragging = false;
+        bool has_focus_rect = false;
+        glm::vec2 focus_start{};
+        glm::vec2 focus_end{};
+
         camera cam;
         GLFWwindow* glwindow;
         Film& film;
@@ -52,12 +60,16 @@ namespace tool {
 
         shared_ptr<tracer> pt;
         callback::callback* cb{};
+        // renders in the background while render() runs
+        unique_ptr<render_loop> renderer;
+        shared_ptr<RenderModeWidget> renderMode;
+        shared_ptr<PerfWidget> perf;
         bool isRendering = false;
         bool canDebugPixels = false;
-        unsigned numSamples = 0;
 
         void switchToWireFrame(bool force);
         void switchToPathTracer(bool force);
+        void updateFocus();
 
     public:
         window(Film& film, shared_ptr<tracer> tr, glm::vec3 look_at, glm::vec3 look_from);
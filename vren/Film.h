@@ -1,40 +1,427 @@
 #pragma once
 
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cmath>
+#include <algorithm>
 #include <yocto/yocto_math.h>
 #include <yocto/yocto_image.h>
 #include "rtweekend.h"
 #include "color.h"
 #include "rawdata.h"
+#include "filter.h"
+#include "exr.h"
+#include "thread_pool.hpp"
+#include "numa.h"
+
+// rectangle of film pixels, [x0, x1) x [y0, y1)
+struct film_rect {
+    int x0, y0, x1, y1;
+};
+
+// auxiliary values of a sample's first hit, a pixel stores their sum
+struct aov_sample {
+    yocto::vec3f albedo = { 0, 0, 0 };
+    yocto::vec3f normal = { 0, 0, 0 };
+    float depth = 0.0f; // distance to the first hit, 0 if the sample missed the scene
+    unsigned hits = 0;  // samples that hit the scene, the summed depth is only theirs
+    int object = -1;    // hittable::id
+    int element = -1;
+    float nodes = 0.0f;     // BVHAccel traversal cost of the sample's path, only counted with VREN_BVH_STATS
+    float triangles = 0.0f;
+
+    void add(const aov_sample& s) {
+        albedo += s.albedo;
+        normal += s.normal;
+        depth += s.depth;
+        hits += s.hits;
+        nodes += s.nodes;
+        triangles += s.triangles;
+        // ids can't be averaged, keep the first sample's
+        if (object == -1) object = s.object;
+        if (element == -1) element = s.element;
+    }
+};
+
+/*
+ Thread local accumulation buffer for a rectangle of the film.
+ Samples are splatted through the film's filter into the tile, which also covers the pixels around
+ the rectangle that the filter reaches. Tiles are merged back into the film once they are done.
+*/
+class FilmTile {
+    friend class Film;
 
-class Film {
 private:
+    const Filter& filter;
+    // tile bounds in film pixels, [x0, x1) x [y0, y1)
+    const int x0, y0, x1, y1;
     std::vector<yocto::vec4f> pixels;
 
+public:
+    FilmTile(const Filter& filter, int x0, int y0, int x1, int y1) :
+        filter(filter), x0(x0), y0(y0), x1(x1), y1(y1), pixels((x1 - x0) * (y1 - y0)) {}
+
+    // (x, y) are continuous film coordinates, pixel (i, j) covers [i, i+1) x [j, j+1)
+    void AddSplat(float x, float y, const yocto::vec3f& c) {
+        // offset to discrete pixel coordinates so pixel centers are integers
+        float dx = x - 0.5f;
+        float dy = y - 0.5f;
+        int px0 = std::max((int)std::ceil(dx - filter.radius), x0);
+        int px1 = std::min((int)std::floor(dx + filter.radius), x1 - 1);
+        int py0 = std::max((int)std::ceil(dy - filter.radius), y0);
+        int py1 = std::min((int)std::floor(dy + filter.radius), y1 - 1);
+
+        for (auto py = py0; py <= py1; py++) {
+            auto row = pixels.data() + (py - y0) * (x1 - x0);
+            for (auto px = px0; px <= px1; px++) {
+                float w = filter.Evaluate(px - dx, py - dy);
+                row[px - x0] += { c.x * w, c.y * w, c.z * w, w };
+            }
+        }
+    }
+};
+
+class Film {
+private:
+    // buffers are explicitly initialized so they can be moved to other NUMA nodes, see FirstTouch()
+    template<typename T>
+    using buffer = std::vector<T, numa::untouched_allocator<T>>;
+
+    buffer<yocto::vec4f> pixels;
+    std::mutex tilesMutex;
+
+    // arbitrary output variables, only allocated when enabled
+    buffer<aov_sample> aovs;
+    buffer<unsigned> samples;
+
+    // below this many pixels dispatching to the pool costs more than it saves
+    static const unsigned minParallelPixels = 512 * 512;
+
+    // tiles that received samples since they were last resolved by ResolveDirty()
+    const int dirtyTilesX, dirtyTilesY;
+    std::unique_ptr<std::atomic<uint8_t>[]> dirty;
+
+    // calls rows(y0, y1) over all the rows, in blocks of contiguous rows spread over the pool for large films
+    template<typename Rows>
+    void ForEachRows(Rows&& rows, thread_pool* pool) const {
+        if (!pool || pixels.size() < minParallelPixels) rows(0u, height);
+        else pool->parallelize_loop(0u, height, rows);
+    }
+
+    template<typename Out>
+    void Resolve(Out* out, Tonemapper tm, thread_pool* pool) const {
+        ForEachRows([&](unsigned start, unsigned end) {
+            resolve_pixels(&pixels[start * width], out + start * width, (end - start) * width, tm);
+            }, pool);
+    }
+
 public:
     const unsigned width;
     const unsigned height;
+    const Filter filter;
+    Tonemapper tonemapper = Tonemapper::Gamma;
+
+    static const int dirtyTileSize = 64;
 
-    Film(unsigned width, unsigned height) :
-        width(width), height(height), pixels(width* height) {}
+    Film(unsigned width, unsigned height, Filter filter = {}) :
+        width(width), height(height), filter(filter), pixels(width* height, yocto::zero4f),
+        dirtyTilesX((width + dirtyTileSize - 1) / dirtyTileSize), dirtyTilesY((height + dirtyTileSize - 1) / dirtyTileSize),
+        dirty(new std::atomic<uint8_t>[dirtyTilesX * dirtyTilesY]) {
+        MarkDirty(0, 0, width, height);
+    }
+
+    // flags the tiles of [x0, x1) x [y0, y1) as changed, grown by the filter's footprint. Samples don't flag their
+    // pixels themselves, renderers call this once they are done with a region
+    void MarkDirty(int x0, int y0, int x1, int y1) {
+        const int border = (int)std::ceil(filter.radius);
+        const int tx0 = std::max(x0 - border, 0) / dirtyTileSize;
+        const int ty0 = std::max(y0 - border, 0) / dirtyTileSize;
+        const int tx1 = std::min((std::min(x1 + border, (int)width) + dirtyTileSize - 1) / dirtyTileSize, dirtyTilesX);
+        const int ty1 = std::min((std::min(y1 + border, (int)height) + dirtyTileSize - 1) / dirtyTileSize, dirtyTilesY);
+        for (auto ty = ty0; ty < ty1; ty++)
+            for (auto tx = tx0; tx < tx1; tx++)
+                dirty[ty * dirtyTilesX + tx].store(1, std::memory_order_relaxed);
+    }
+
+    // resolves the dirty tiles into bytes, a persistent width x height buffer, and appends them to rects
+    // must not run concurrently with itself, tiles flagged while it runs are resolved by the next call
+    void ResolveDirty(yocto::vec4b* bytes, std::vector<film_rect>& rects, thread_pool* pool = nullptr) {
+        const auto first = rects.size();
+        for (auto ty = 0; ty < dirtyTilesY; ty++) {
+            for (auto tx = 0; tx < dirtyTilesX; tx++) {
+                if (!dirty[ty * dirtyTilesX + tx].exchange(0, std::memory_order_acquire)) continue;
+                rects.push_back({ tx * dirtyTileSize, ty * dirtyTileSize,
+                    std::min((tx + 1) * dirtyTileSize, (int)width), std::min((ty + 1) * dirtyTileSize, (int)height) });
+            }
+        }
+
+        auto resolveRects = [&](size_t start, size_t end) {
+            for (auto r = start; r < end; r++) {
+                const auto& rect = rects[r];
+                for (auto y = rect.y0; y < rect.y1; y++) {
+                    const auto offset = y * width + rect.x0;
+                    resolve_pixels(&pixels[offset], bytes + offset, rect.x1 - rect.x0, tonemapper);
+                }
+            }
+        };
+        const auto count = rects.size() - first;
+        if (pool && count * dirtyTileSize * dirtyTileSize >= minParallelPixels)
+            pool->parallelize_loop(first, rects.size(), resolveRects);
+        else
+            resolveRects(first, rects.size());
+    }
 
     void AddSample(int x, int y, const yocto::vec3f& c, double weight = 1.0) {
         pixels[y * width + x] += { c.x, c.y, c.z, (float)weight };
     }
 
-    void GetImage(yocto::color_image& image) const {
-        for (auto x = 0; x < width; x++) {
-            for (auto y = 0; y < height; y++) {
-                const auto& p = pixels[x + y * width];
-                auto c = convert(vec3(p.x, p.y, p.z), (unsigned)p.w);
-                yocto::set_pixel(image, x, y, c);
+    // adds the same sample to every pixel of [x0, x1) x [y0, y1), used by low resolution previews
+    void AddBlock(int x0, int y0, int x1, int y1, const yocto::vec3f& c, double weight = 1.0) {
+        for (auto y = std::max(y0, 0); y < std::min(y1, (int)height); y++)
+            for (auto x = std::max(x0, 0); x < std::min(x1, (int)width); x++)
+                AddSample(x, y, c, weight);
+    }
+
+    // creates a tile for samples inside [x0, x1) x [y0, y1), grown by the filter's footprint
+    FilmTile GetTile(int x0, int y0, int x1, int y1) const {
+        int border = (int)std::ceil(filter.radius);
+        return FilmTile(filter,
+            std::max(x0 - border, 0), std::max(y0 - border, 0),
+            std::min(x1 + border, (int)width), std::min(y1 + border, (int)height));
+    }
+
+    void MergeTile(const FilmTile& tile) {
+        const int tileWidth = tile.x1 - tile.x0;
+        const std::lock_guard<std::mutex> lock(tilesMutex);
+        for (auto y = tile.y0; y < tile.y1; y++) {
+            auto src = &tile.pixels[(y - tile.y0) * tileWidth];
+            auto dst = &pixels[y * width + tile.x0];
+            for (auto x = 0; x < tileWidth; x++) dst[x] += src[x];
+        }
+    }
+
+    // image must be width x height
+    void GetImage(yocto::color_image& image, thread_pool* pool = nullptr) const {
+        Resolve(image.pixels.data(), tonemapper, pool);
+    }
+
+    // resolved color without any tonemapping
+    void GetLinear(yocto::vec4f* out, thread_pool* pool = nullptr) const {
+        Resolve(out, Tonemapper::Linear, pool);
+    }
+
+    // resolves straight into an 8 bit RGBA buffer of width x height pixels
+    void GetBytes(yocto::vec4b* bytes, thread_pool* pool = nullptr) const {
+        Resolve(bytes, tonemapper, pool);
+    }
+
+    void EnableAOVs() {
+        aovs.assign(width * height, aov_sample{});
+        samples.assign(width * height, 0);
+    }
+
+    // moves the buffers to untouched memory. forEachRows(copyRows) must call copyRows(y0, y1) over all the rows,
+    // from the threads that will use them, so the pages of each row are placed on the NUMA node of its threads
+    template<typename ForEachRows>
+    void FirstTouch(ForEachRows&& forEachRows) {
+        buffer<yocto::vec4f> newPixels(pixels.size());
+        buffer<aov_sample> newAovs(aovs.size());
+        buffer<unsigned> newSamples(samples.size());
+        forEachRows([&](unsigned y0, unsigned y1) {
+            const auto begin = y0 * width;
+            const auto end = y1 * width;
+            std::copy(pixels.begin() + begin, pixels.begin() + end, newPixels.begin() + begin);
+            if (HasAOVs()) {
+                std::copy(aovs.begin() + begin, aovs.begin() + end, newAovs.begin() + begin);
+                std::copy(samples.begin() + begin, samples.begin() + end, newSamples.begin() + begin);
+            }
+            });
+        pixels.swap(newPixels);
+        aovs.swap(newAovs);
+        samples.swap(newSamples);
+    }
+
+    bool HasAOVs() const { return !aovs.empty(); }
+
+    /*
+     Moves the accumulated samples to the pixels they land on after a camera move, instead of clearing them.
+     target(x, y, depth, tx, ty, newDepth) maps pixel (x, y), whose first hits are at the given average depth or 0 if
+     they missed the scene, to pixel (tx, ty) of the new camera and its depth there. It returns false when the pixel
+     leaves the film.
+     Pixels whose samples both hit and missed the scene have no single depth, they start over.
+     When several pixels land on the same one the closest is kept. Pixels that receive none were disoccluded and
+     start over, as do the ones next to a surface closer by more than tolerance, their samples may belong to either.
+     Carried samples count for at most maxWeight, times decay, so the history fades out as the camera keeps moving.
+     AOVs must be enabled, carried pixels keep their averaged AOVs as a single sample
+    */
+    template<typename Target>
+    void Reproject(Target&& target, float maxWeight, float decay, float tolerance, thread_pool* pool = nullptr) {
+        const int size = width * height;
+        std::vector<int> dest(size, -1);
+        std::vector<float> destDepth(size);
+        ForEachRows([&](unsigned y0, unsigned y1) {
+            for (auto y = (int)y0; y < (int)y1; y++) {
+                for (auto x = 0; x < (int)width; x++) {
+                    const int idx = y * width + x;
+                    const unsigned hits = aovs[idx].hits;
+                    if (samples[idx] == 0 || (hits > 0 && hits < samples[idx])) continue;
+                    const float depth = hits > 0 ? aovs[idx].depth / hits : 0.0f;
+                    int tx, ty;
+                    if (target(x, y, depth, tx, ty, destDepth[idx])) dest[idx] = ty * width + tx;
+                }
             }
+            }, pool);
+
+        // closest pixel landing on each pixel
+        std::vector<int> source(size, -1);
+        for (auto idx = 0; idx < size; idx++) {
+            const int d = dest[idx];
+            if (d >= 0 && (source[d] < 0 || destDepth[idx] < destDepth[source[d]])) source[d] = idx;
+        }
+
+        const std::vector<yocto::vec4f> oldPixels(pixels.begin(), pixels.end());
+        const std::vector<aov_sample> oldAovs(aovs.begin(), aovs.end());
+        const std::vector<unsigned> oldSamples(samples.begin(), samples.end());
+        // the buffers are written in place so they stay on their NUMA nodes
+        ForEachRows([&](unsigned y0, unsigned y1) {
+            for (auto y = (int)y0; y < (int)y1; y++) {
+                for (auto x = 0; x < (int)width; x++) {
+                    const int idx = y * width + x;
+                    const int src = source[idx];
+                    bool keep = src >= 0 && oldPixels[src].w > 0.0f;
+                    if (keep) {
+                        const float closer = destDepth[src] * (1.0f - tolerance);
+                        for (auto ny = std::max(y - 1, 0); ny <= std::min(y + 1, (int)height - 1); ny++) {
+                            for (auto nx = std::max(x - 1, 0); nx <= std::min(x + 1, (int)width - 1); nx++) {
+                                const int n = source[ny * width + nx];
+                                if (n >= 0 && destDepth[n] < closer) keep = false;
+                            }
+                        }
+                    }
+                    if (!keep) {
+                        pixels[idx] = yocto::zero4f;
+                        aovs[idx] = aov_sample{};
+                        samples[idx] = 0;
+                        continue;
+                    }
+
+                    const auto& c = oldPixels[src];
+                    pixels[idx] = c * (std::min(c.w, maxWeight) * decay / c.w);
+
+                    aov_sample a = oldAovs[src];
+                    const float scale = 1.0f / oldSamples[src];
+                    a.albedo = a.albedo * scale;
+                    a.normal = a.normal * scale;
+                    a.nodes *= scale;
+                    a.triangles *= scale;
+                    a.depth = std::isinf(destDepth[src]) ? 0.0f : destDepth[src];
+                    a.hits = a.depth > 0.0f ? 1 : 0;
+                    aovs[idx] = a;
+                    samples[idx] = 1;
+                }
+            }
+            }, pool);
+        MarkDirty(0, 0, width, height);
+    }
+
+    // sum holds the aovs of count samples
+    void AddAOVs(int x, int y, const aov_sample& sum, unsigned count) {
+        const auto idx = y * width + x;
+        aovs[idx].add(sum);
+        samples[idx] += count;
+    }
+
+    // averaged albedo and depth of every pixel and the direction of its averaged normal, zero where no sample hit
+    // the scene. Film must have AOVs enabled
+    void GetGuides(std::vector<yocto::vec3f>& albedo, std::vector<yocto::vec3f>& normal, std::vector<float>& depth) const {
+        const auto size = width * height;
+        albedo.resize(size);
+        normal.resize(size);
+        depth.resize(size);
+        for (auto i = 0; i < size; i++) {
+            const auto& a = aovs[i];
+            float scale = samples[i] > 0 ? 1.0f / samples[i] : 0.0f;
+            albedo[i] = a.albedo * scale;
+            // the average of different normals is shorter than 1, only its direction is kept
+            const float norm = yocto::length(a.normal);
+            normal[i] = norm > 0.0f ? a.normal / norm : a.normal;
+            depth[i] = a.depth * scale;
+        }
+    }
+
+    // false color image of the traversal cost (nodes visited + triangles tested) per sample
+    // blue is free, red is maxCost or above. When maxCost is 0 the most expensive pixel is used
+    void GetTraversalHeatmap(yocto::color_image& image, float maxCost = 0.0f) const {
+        const auto size = width * height;
+        std::vector<float> cost(size);
+        for (auto i = 0; i < size; i++) {
+            cost[i] = samples[i] > 0 ? (aovs[i].nodes + aovs[i].triangles) / samples[i] : 0.0f;
+        }
+        if (maxCost <= 0.0f) maxCost = std::max(*std::max_element(cost.begin(), cost.end()), 1.0f);
+
+        for (auto i = 0; i < size; i++) {
+            const float t = std::min(cost[i] / maxCost, 1.0f);
+            // blue -> green -> red
+            image.pixels[i] = t < 0.5f ?
+                yocto::vec4f{ 0.0f, 2 * t, 1.0f - 2 * t, 1.0f } :
+                yocto::vec4f{ 2 * t - 1.0f, 2.0f - 2 * t, 0.0f, 1.0f };
+        }
+    }
+
+    // saves color and all aovs as layers of a single EXR file
+    bool SaveAOVs(const std::string& filename, std::string& error) const {
+        if (!HasAOVs()) {
+            error = "AOVs are not enabled";
+            return false;
+        }
+
+        const auto size = width * height;
+        std::vector<yocto::vec4f> resolved(size);
+        GetLinear(resolved.data());
+        std::vector<yocto::vec3f> albedo, normal;
+        std::vector<float> depth;
+        GetGuides(albedo, normal, depth);
+
+        std::vector<std::vector<float>> layers(9, std::vector<float>(size));
+        std::vector<uint32_t> objects(size), elements(size);
+        for (auto i = 0; i < size; i++) {
+            for (auto c = 0; c < 3; c++) {
+                layers[c][i] = resolved[i][c];
+                layers[3 + c][i] = albedo[i][c];
+                layers[6 + c][i] = normal[i][c];
+            }
+            // -1 (no hit) wraps to 0xFFFFFFFF
+            objects[i] = (uint32_t)aovs[i].object;
+            elements[i] = (uint32_t)aovs[i].element;
+        }
+
+        std::vector<exr::channel> channels = {
+            { "R", layers[0] }, { "G", layers[1] }, { "B", layers[2] },
+            { "albedo.R", layers[3] }, { "albedo.G", layers[4] }, { "albedo.B", layers[5] },
+            { "normal.X", layers[6] }, { "normal.Y", layers[7] }, { "normal.Z", layers[8] },
+            { "depth.Z", depth },
+            { "id.object", objects },
+            { "id.element", elements },
+            { "samples.count", std::vector<uint32_t>(samples.begin(), samples.end()) }
+        };
+#ifdef VREN_BVH_STATS
+        std::vector<float> nodes(size), triangles(size);
+        for (auto i = 0; i < size; i++) {
+            float scale = samples[i] > 0 ? 1.0f / samples[i] : 0.0f;
+            nodes[i] = aovs[i].nodes * scale;
+            triangles[i] = aovs[i].triangles * scale;
         }
+        channels.push_back({ "traversal.nodes", nodes });
+        channels.push_back({ "traversal.triangles", triangles });
+#endif
+        return exr::save(filename, width, height, channels, error);
     }
 
     void GetRaw(RawData& raw) const {
-        for (auto x = 0; x < width; x++) {
-            for (auto y = 0; y < height; y++) {
+        for (auto y = 0; y < height; y++) {
+            for (auto x = 0; x < width; x++) {
                 const auto& p = pixels[x + y * width];
                 raw.set(x, y, vec3(p.x / p.w, p.y / p.w, p.z / p.w));
             }
@@ -43,5 +430,8 @@ public:
 
     void Clear() {
         std::fill(pixels.begin(), pixels.end(), yocto::zero4f);
+        std::fill(aovs.begin(), aovs.end(), aov_sample{});
+        std::fill(samples.begin(), samples.end(), 0);
+        MarkDirty(0, 0, width, height);
     }
 };
\ No newline at end of file
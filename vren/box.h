@@ -11,11 +11,13 @@ public:
     box(std::string name, const point3& center, const vec3& size, std::shared_ptr<material> m) :
         hittable(name + "_box"), bmin(center - size / 2), bmax(center + size / 2), mat_ptr(m) {}
 
-    virtual bool hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const override {
-        float tmin = -INFINITY;
-        float tmax = INFINITY;
-        int amin = -1;
-        int amax = -1;
+private:
+    // [tmin, tmax] is the part of the ray line inside the box, amin/amax the axes of the entry/exit faces
+    bool slabs(const ray& r, float& tmin, float& tmax, int& amin, int& amax) const {
+        tmin = -INFINITY;
+        tmax = INFINITY;
+        amin = -1;
+        amax = -1;
 
         for (int a = 0; a < 3; a++) {
             double invD = 1.0 / r.direction()[a];
@@ -37,28 +39,96 @@ public:
             }
             if (tmax < tmin) return false;
         }
+        return true;
+    }
+
+    // is the box surface crossed within [t_min, t_max] ?
+    static bool inRange(float tmin, float tmax, double t_min, double t_max) {
+        return !((tmin >= t_max) || (tmax <= t_min) || (tmin <= t_min && tmax > t_max));
+    }
+
+public:
+    virtual bool intersect(const ray& r, const double t_min, const double t_max, hit_candidate& cand) const override {
+        float tmin, tmax;
+        int amin, amax;
+        if (!slabs(r, tmin, tmax, amin, amax))
+            return false;
 
         // [tmin, tmax] are the smallest and biggest t values on the ray line
-        if ((tmin >= t_max) || (tmax <= t_min) || (tmin <= t_min && tmax > t_max)) 
+        if (!inRange(tmin, tmax, t_min, t_max))
             return false;
         // at this point we are guaranteed to find an intersection with the box
         bool useMax = tmin <= t_min; // is the ray inside the box ?
 
-        rec.t = useMax ? tmax : tmin;
+        cand.t = useMax ? tmax : tmin;
+        cand.element = useMax ? amax : amin; // axis of the hit face
+        return true;
+    }
+
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const override {
+        rec.t = cand.t;
         rec.p = r.at(rec.t);
 
         vec3 center = (bmax + bmin) / 2;
         vec3 norm{};
-        norm[useMax ? amax : amin] = (rec.p - center)[useMax ? amax : amin];
+        norm[cand.element] = (rec.p - center)[cand.element];
         rec.set_face_normal(r, unit_vector(norm));
 
         rec.u = 0;
         rec.v = 0;
+        rec.element = -1;
 
         rec.mat_ptr = mat_ptr.get();
+    }
 
-        return true;
+    // slabs() and intersect() without the early outs, so the loop can be vectorized
+    virtual void intersect_batch(ray_batch& b) const override {
+        const size_t n = b.size();
+        std::vector<double> ts(n);
+        std::vector<int> axes(n);
+        std::vector<uint8_t> hits(n);
+        const double* o[3] = { b.ox.data(), b.oy.data(), b.oz.data() };
+        const double* d[3] = { b.dx.data(), b.dy.data(), b.dz.data() };
+        for (size_t i = 0; i < n; i++) {
+            float tmin = -INFINITY;
+            float tmax = INFINITY;
+            int amin = -1;
+            int amax = -1;
+            bool miss = false;
+            for (int a = 0; a < 3; a++) {
+                const double invD = 1.0 / d[a][i];
+                const double ta = (bmin[a] - o[a][i]) * invD;
+                const double tb = (bmax[a] - o[a][i]) * invD;
+                const double t0 = invD < 0 ? tb : ta;
+                const double t1 = invD < 0 ? ta : tb;
+                amin = t0 > tmin ? a : amin;
+                tmin = t0 > tmin ? t0 : tmin;
+                amax = t1 < tmax ? a : amax;
+                tmax = t1 < tmax ? t1 : tmax;
+                miss = miss || tmax < tmin;
+            }
+
+            const bool useMax = tmin <= b.tmin[i];
+            ts[i] = useMax ? tmax : tmin;
+            axes[i] = useMax ? amax : amin;
+            hits[i] = !miss && inRange(tmin, tmax, b.tmin[i], b.tmax[i]);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (hits[i]) b.setHit(i, { ts[i], 0, 0, axes[i], id });
+        }
+    }
 
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        float tmin, tmax;
+        int amin, amax;
+        return slabs(r, tmin, tmax, amin, amax) && inRange(tmin, tmax, t_min, t_max);
+    }
+
+    virtual bool bounding_box(point3& lo, point3& hi) const override {
+        lo = bmin;
+        hi = bmax;
+        return true;
     }
 
     const vec3 bmin;
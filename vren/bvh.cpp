@@ -1,6 +1,7 @@
 #include "bvh.h"
 
 #include "bvh_structs.h"
+#include "stats.h"
 
 #include <algorithm>
 #include <fstream>
@@ -345,6 +346,33 @@ void BVHAccel::flattenBVHTree(BVHBuildNode* node, int offset, int* firstChildOff
 }
 
 bool BVHAccel::hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist) const {
+#ifdef VREN_BVH_STATS
+    return traverse<true, false>(r, uv, element, dist, &thread_traversal_stats());
+#else
+    return traverse<false, false>(r, uv, element, dist, nullptr);
+#endif
+}
+
+bool BVHAccel::hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist, traversal_stats& stats) const {
+    return traverse<true, false>(r, uv, element, dist, &stats);
+}
+
+bool BVHAccel::occluded(const yocto::ray3f& r) const {
+    yocto::vec2f uv;
+    int element;
+    float dist;
+#ifdef VREN_BVH_STATS
+    return traverse<true, true>(r, uv, element, dist, &thread_traversal_stats());
+#else
+    return traverse<false, true>(r, uv, element, dist, nullptr);
+#endif
+}
+
+// counting and any hit are resolved at compile time so the plain hit() doesn't pay for them
+template<bool CollectStats, bool AnyHit>
+bool BVHAccel::traverse(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist, traversal_stats* stats) const {
+    if constexpr (CollectStats) stats->rays++;
+
     yocto::vec3f invDir = 1.0f / r.d;
     yocto::vec3i dirIsNeg = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
 
@@ -359,10 +387,16 @@ bool BVHAccel::hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist)
 
     while (true) {
         if (currentNPrimitives > 0) {
+            if constexpr (CollectStats) {
+                stats->leaves++;
+                stats->triangles += currentNPrimitives;
+            }
+
             // Intersect ray with primitives in leaf BVH node
             for (auto idx = currentOffset; idx < currentOffset + currentNPrimitives; idx++) {
                 const auto& t = shape.triangles[elements[idx]];
                 if (intersect_triangle(r, shape.positions[t.x], shape.positions[t.y], shape.positions[t.z], uv, dist)) {
+                    if constexpr (AnyHit) return true;
                     r.tmax = dist;
                     element = elements[idx];
                     found = true;
@@ -373,6 +407,8 @@ bool BVHAccel::hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist)
             currentNPrimitives = nodesToVisit[--toVisitOffset];
         }
         else {
+            if constexpr (CollectStats) stats->nodes++;
+
             // load both children at once
             const LinearBVHNode& left  = nodes[currentOffset];
             const LinearBVHNode& right = nodes[currentOffset + 1];
@@ -392,6 +428,8 @@ bool BVHAccel::hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist)
                     nodesToVisit[toVisitOffset++] = right.nPrimitives;
                     nodesToVisit[toVisitOffset++] = right.firstChildOffset;
                 }
+                // every stack entry takes 2 ints
+                if constexpr (CollectStats) stats->max_stack = std::max(stats->max_stack, (uint64_t)toVisitOffset / 2);
             }
             // move to closest node
             if (traverseLeft || traverseRight) {
@@ -415,11 +453,107 @@ bool BVHAccel::hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist)
     return found;
 }
 
+void BVHAccel::hit(ray_packet& packet) const {
+#ifdef VREN_BVH_STATS
+    traversePacket<true>(packet, &thread_traversal_stats());
+#else
+    traversePacket<false>(packet, nullptr);
+#endif
+}
+
+void BVHAccel::hit(ray_packet& packet, traversal_stats& stats) const {
+    traversePacket<true>(packet, &stats);
+}
+
+template<bool CollectStats>
+void BVHAccel::traversePacket(ray_packet& p, traversal_stats* stats) const {
+    if constexpr (CollectStats) stats->rays += p.count;
+
+    float invX[ray_packet::maxSize], invY[ray_packet::maxSize], invZ[ray_packet::maxSize];
+    for (auto k = 0; k < p.count; k++) {
+        invX[k] = 1.0f / p.dx[k];
+        invY[k] = 1.0f / p.dy[k];
+        invZ[k] = 1.0f / p.dz[k];
+        p.element[k] = -1;
+    }
+
+    // nearest entry distance of the packet's rays into b, infinity if none of them hits it
+    auto packetHit = [&](const yocto::bbox3f& b) {
+        float nearest = yocto::flt_max;
+        for (auto k = 0; k < p.count; k++) {
+            const float x0 = (b.min.x - p.ox[k]) * invX[k], x1 = (b.max.x - p.ox[k]) * invX[k];
+            const float y0 = (b.min.y - p.oy[k]) * invY[k], y1 = (b.max.y - p.oy[k]) * invY[k];
+            const float z0 = (b.min.z - p.oz[k]) * invZ[k], z1 = (b.max.z - p.oz[k]) * invZ[k];
+            const float tNear = std::max(std::max(p.tmin[k], std::min(x0, x1)), std::max(std::min(y0, y1), std::min(z0, z1)));
+            const float tFar = std::min(std::min(p.tmax[k], std::max(x0, x1)), std::min(std::max(y0, y1), std::max(z0, z1)));
+            nearest = tNear <= tFar ? std::min(nearest, tNear) : nearest;
+        }
+        return nearest;
+    };
+
+    // same layout as the single ray traversal, pairs of (nPrimitives, offset)
+    int toVisitOffset = 0;
+    int nodesToVisit[64 * 2];
+    nodesToVisit[toVisitOffset++] = 0;
+    nodesToVisit[toVisitOffset++] = 1; // nodes[0] is automatically intersected
+
+    while (toVisitOffset > 0) {
+        const int currentOffset = nodesToVisit[--toVisitOffset];
+        const int currentNPrimitives = nodesToVisit[--toVisitOffset];
+
+        if (currentNPrimitives > 0) {
+            if constexpr (CollectStats) {
+                stats->leaves++;
+                stats->triangles += currentNPrimitives * p.count;
+            }
+
+            for (auto idx = currentOffset; idx < currentOffset + currentNPrimitives; idx++) {
+                const auto& t = shape.triangles[elements[idx]];
+                const auto& p0 = shape.positions[t.x];
+                const auto& p1 = shape.positions[t.y];
+                const auto& p2 = shape.positions[t.z];
+                for (auto k = 0; k < p.count; k++) {
+                    yocto::ray3f r = { { p.ox[k], p.oy[k], p.oz[k] }, { p.dx[k], p.dy[k], p.dz[k] }, p.tmin[k], p.tmax[k] };
+                    yocto::vec2f uv;
+                    float dist;
+                    if (intersect_triangle(r, p0, p1, p2, uv, dist)) {
+                        p.tmax[k] = dist;
+                        p.element[k] = elements[idx];
+                        p.u[k] = uv.x;
+                        p.v[k] = uv.y;
+                    }
+                }
+            }
+        }
+        else {
+            if constexpr (CollectStats) stats->nodes++;
+
+            const LinearBVHNode& left = nodes[currentOffset];
+            const LinearBVHNode& right = nodes[currentOffset + 1];
+            const float leftDist = packetHit(left.bounds);
+            const float rightDist = packetHit(right.bounds);
+            const bool traverseLeft = leftDist < yocto::flt_max;
+            const bool traverseRight = rightDist < yocto::flt_max;
+
+            // push the farthest node first, so the closest one is visited next
+            const bool leftFirst = leftDist <= rightDist;
+            const LinearBVHNode* order[2] = { leftFirst ? &right : &left, leftFirst ? &left : &right };
+            const bool traverse[2] = { leftFirst ? traverseRight : traverseLeft, leftFirst ? traverseLeft : traverseRight };
+            for (auto c = 0; c < 2; c++) {
+                if (!traverse[c]) continue;
+                nodesToVisit[toVisitOffset++] = order[c]->nPrimitives;
+                nodesToVisit[toVisitOffset++] = order[c]->firstChildOffset;
+            }
+            if constexpr (CollectStats) stats->max_stack = std::max(stats->max_stack, (uint64_t)toVisitOffset / 2);
+        }
+    }
+}
+
 std::shared_ptr<BVHAccel> BVHAccel::Create(const yocto::scene_shape &shape, BVHAccel::SplitMethod splitMethod) {
-    clock_t start = clock();
+    wall_timer timer;
     auto bvh = std::make_shared<BVHAccel>(shape, splitMethod);
-    clock_t stop = clock();
-    double timer_seconds = ((double)(stop - start)) / CLOCKS_PER_SEC;
+    double timer_seconds = timer.elapsed_seconds();
+    total_bvh_build_seconds += timer_seconds;
     std::cerr << "BVH build time: " << timer_seconds << " seconds\n";
 
     return bvh;
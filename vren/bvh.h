@@ -7,6 +7,7 @@
 
 #include "rtweekend.h"
 #include "hit_record.h"
+#include "stats.h"
 
 struct BVHBuildNode;
 struct Primitive;
@@ -14,6 +15,18 @@ struct LinearBVHNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 
+// rays traversed together by BVHAccel, in structure of arrays layout
+struct ray_packet {
+    static const int maxSize = 64;
+    int count = 0;
+    float ox[maxSize], oy[maxSize], oz[maxSize];
+    float dx[maxSize], dy[maxSize], dz[maxSize];
+    float tmin[maxSize], tmax[maxSize]; // tmax is updated to the closest hit
+    // outputs, element is -1 for rays that didn't hit anything
+    int element[maxSize];
+    float u[maxSize], v[maxSize];
+};
+
 class BVHAccel {
 public:
     // BVHAccel Public Types
@@ -25,6 +38,15 @@ public:
     ~BVHAccel();
 
     bool hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist) const;
+    // same as hit() but also adds the cost of the traversal to stats
+    bool hit(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist, traversal_stats& stats) const;
+    // stops at the first triangle hit within [r.tmin, r.tmax]
+    bool occluded(const yocto::ray3f& r) const;
+    // closest hit of every ray of the packet, a node is visited when any of the rays hits its bounds
+    void hit(ray_packet& packet) const;
+    // same as hit() but also adds the cost of the traversal to stats, nodes are counted once per packet
+    // so nodes / rays measures how well the packet's rays share their traversal
+    void hit(ray_packet& packet, traversal_stats& stats) const;
 
     static std::shared_ptr<BVHAccel> Create(const yocto::scene_shape& shape, SplitMethod splitMethod = SplitMethod::EqualCounts);
 
@@ -38,6 +60,11 @@ private:
     void computeQuality(const BVHBuildNode* node, float rootSA, float* largestOverlap);
     float sahCost(const BVHBuildNode* node, float rootSA) const;
 
+    template<bool CollectStats, bool AnyHit>
+    bool traverse(yocto::ray3f r, yocto::vec2f& uv, int& element, float& dist, traversal_stats* stats) const;
+    template<bool CollectStats>
+    void traversePacket(ray_packet& p, traversal_stats* stats) const;
+
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
@@ -40,7 +40,7 @@ public:
         bvh = BVHAccel::Create(shape, BVHAccel::SplitMethod::SAH);
     }
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const override {
         yocto::ray3f r3f = {
             toYocto(r.origin()),
             toYocto(r.direction()),
@@ -50,27 +50,65 @@ public:
         yocto::vec2f uv;
         float dist;
         int element;
-        if (bvh->hit(r3f, uv, element, dist)) {
-            rec.t = dist;
+        if (!bvh->hit(r3f, uv, element, dist))
+            return false;
+
+        cand.t = dist;
+        cand.u = uv.x;
+        cand.v = uv.y;
+        cand.element = element;
+        return true;
+    }
+
+    // rays go through BVHAccel in packets, coherent rays share most of their node visits
+    virtual void intersect_batch(ray_batch& b) const override {
+        ray_packet packet;
+        for (size_t start = 0; start < b.size(); start += ray_packet::maxSize) {
+            packet.count = (int)std::min(b.size() - start, (size_t)ray_packet::maxSize);
+            for (auto k = 0; k < packet.count; k++) {
+                const auto i = start + k;
+                packet.ox[k] = (float)b.ox[i]; packet.oy[k] = (float)b.oy[i]; packet.oz[k] = (float)b.oz[i];
+                packet.dx[k] = (float)b.dx[i]; packet.dy[k] = (float)b.dy[i]; packet.dz[k] = (float)b.dz[i];
+                packet.tmin[k] = (float)b.tmin[i];
+                packet.tmax[k] = (float)b.tmax[i];
+            }
+
+            bvh->hit(packet);
+
+            for (auto k = 0; k < packet.count; k++) {
+                if (packet.element[k] != -1)
+                    b.setHit(start + k, { packet.tmax[k], packet.u[k], packet.v[k], packet.element[k], id });
+            }
+        }
+    }
 
-            // first compute geometric normal
-            auto outward_normal = yocto::eval_normal(shape, element, uv);
-            rec.set_face_normal(r, fromYocto(outward_normal));
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const override {
+        const yocto::vec2f uv = { cand.u, cand.v };
+        rec.t = cand.t;
 
-            // then compute intersection point using uv coordinates to reduce floating point imprecision effects
-            auto p = yocto::eval_position(shape, element, uv);
-            //rec.p = fromYocto(yocto::offset_ray(p, outward_normal));
-            rec.p = fromYocto(p);
+        // first compute geometric normal
+        auto outward_normal = yocto::eval_normal(shape, cand.element, uv);
+        rec.set_face_normal(r, fromYocto(outward_normal));
 
-            rec.u = uv.x;
-            rec.v = uv.y;
-            rec.element = element;
-            rec.mat_ptr = mat;
+        // then compute intersection point using uv coordinates to reduce floating point imprecision effects
+        auto p = yocto::eval_position(shape, cand.element, uv);
+        //rec.p = fromYocto(yocto::offset_ray(p, outward_normal));
+        rec.p = fromYocto(p);
 
-            return true;
-        }
+        rec.u = cand.u;
+        rec.v = cand.v;
+        rec.element = cand.element;
+        rec.mat_ptr = mat.get();
+    }
 
-        return false;
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        yocto::ray3f r3f = {
+            toYocto(r.origin()),
+            toYocto(r.direction()),
+            (float)t_min,
+            (float)t_max
+        };
+        return bvh->occluded(r3f);
     }
 
     yocto::scene_shape shape;
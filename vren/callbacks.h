@@ -5,6 +5,7 @@
 #include <limits>
 
 #include "tracer_callback.h"
+#include "rayset.h"
 
 namespace callback {
     class collect_hits : public callback {
@@ -661,4 +662,31 @@ namespace callback {
             return out;
         }
     };
+
+    // captures the rays a render generates, must be used with a non parallel render
+    class record_rays : public callback {
+    private:
+        RaySet& set;
+        const size_t maxRaysPerKind;
+
+        void add(RaySet::Kind kind, const vec3& o, const vec3& d) {
+            if (set.rays[kind].size() < maxRaysPerKind)
+                set.add(kind, { toYocto(o), toYocto(d), 0.001f }); // same t_min as the pathtracer
+        }
+
+    public:
+        record_rays(RaySet& set, size_t maxRaysPerKind) : set(set), maxRaysPerKind(maxRaysPerKind) {}
+
+        virtual void operator ()(event_ptr e) override {
+            if (auto n = cast<New>(e)) {
+                add(RaySet::Primary, n->r.origin(), n->r.direction());
+            }
+            else if (auto s = cast<SpecularScatter>(e)) {
+                add(RaySet::Specular, s->rec.p, s->d);
+            }
+            else if (auto s = cast<DiffuseScatter>(e)) {
+                add(RaySet::Diffuse, s->rec.p, s->d);
+            }
+        }
+    };
 }
\ No newline at end of file
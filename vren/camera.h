@@ -30,6 +30,26 @@ public:
             lower_left_corner + s * horizontal + t * vertical - lookfrom - offset };
     }
 
+    // direction of the ray through (s, t) from the center of the lens
+    vec3 get_direction(double s, double t) const {
+        return lower_left_corner + s * horizontal + t * vertical - lookfrom;
+    }
+
+    // inverse of get_direction(), finds the (s, t) whose ray goes through p and the distance from the lens center to p,
+    // the same distance as the t of a hit along the normalized ray. False when p is behind the camera
+    bool project(const point3& p, double& s, double& t, double& depth) const {
+        auto focus_dist = (lookfrom - lookat).length();
+        auto d = p - lookfrom;
+        auto dw = -dot(d, w);
+        if (dw <= 0) return false;
+
+        auto q = lookfrom + d * (focus_dist / dw) - lower_left_corner;
+        s = dot(q, horizontal) / horizontal.length_squared();
+        t = dot(q, vertical) / vertical.length_squared();
+        depth = d.length();
+        return true;
+    }
+
     point3 getLookAt() const { return lookat; }
     point3 getLookFrom() const { return lookfrom; }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <algorithm>
 
 #include "vec3.h"
 #include <yocto/yocto_image.h>
@@ -65,3 +66,71 @@ inline yocto::vec4f convert(const color& pixel_color, unsigned spp, bool gamma_c
         1.0f
     };
 }
+
+enum class Tonemapper { Linear, Gamma, ACES, Filmic };
+
+template<Tonemapper TM>
+inline float tonemap_channel(float c) {
+    if constexpr (TM == Tonemapper::Linear) {
+        return c;
+    }
+    else if constexpr (TM == Tonemapper::Gamma) {
+        // gamma 2.0, same as convert()
+        return std::sqrt(std::min(std::max(c, 0.0f), 1.0f));
+    }
+    else if constexpr (TM == Tonemapper::ACES) {
+        // Narkowicz's ACES fit followed by gamma 2.0
+        c = std::max(c, 0.0f);
+        c = (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+        return std::sqrt(std::min(c, 1.0f));
+    }
+    else {
+        // Hejl-Burgess-Dawson filmic curve, gamma is baked into the curve
+        c = std::max(c - 0.004f, 0.0f);
+        return (c * (6.2f * c + 0.5f)) / (c * (6.2f * c + 1.7f) + 0.06f);
+    }
+}
+
+inline void store_pixel(yocto::vec4f& out, float r, float g, float b) {
+    out = { r, g, b, 1.0f };
+}
+
+inline void store_pixel(yocto::vec4b& out, float r, float g, float b) {
+    // same rounding as yocto::float_to_byte
+    out = {
+        (unsigned char)std::clamp((int)(r * 256), 0, 255),
+        (unsigned char)std::clamp((int)(g * 256), 0, 255),
+        (unsigned char)std::clamp((int)(b * 256), 0, 255),
+        255
+    };
+}
+
+// resolves accumulated pixels (weighted color sum in xyz, total weight in w) and tonemaps them.
+// the loop body is branch free so the compiler can vectorize it
+template<Tonemapper TM, typename Out>
+inline void resolve_pixels(const yocto::vec4f* in, Out* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const auto& p = in[i];
+        float scale = p.w > 0.0f ? 1.0f / p.w : 0.0f;
+        float r = p.x * scale;
+        float g = p.y * scale;
+        float b = p.z * scale;
+
+        // Replace NaN components with zero
+        r = r == r ? r : 0.0f;
+        g = g == g ? g : 0.0f;
+        b = b == b ? b : 0.0f;
+
+        store_pixel(out[i], tonemap_channel<TM>(r), tonemap_channel<TM>(g), tonemap_channel<TM>(b));
+    }
+}
+
+template<typename Out>
+inline void resolve_pixels(const yocto::vec4f* in, Out* out, size_t count, Tonemapper tm) {
+    switch (tm) {
+    case Tonemapper::Linear: resolve_pixels<Tonemapper::Linear>(in, out, count); break;
+    case Tonemapper::Gamma: resolve_pixels<Tonemapper::Gamma>(in, out, count); break;
+    case Tonemapper::ACES: resolve_pixels<Tonemapper::ACES>(in, out, count); break;
+    case Tonemapper::Filmic: resolve_pixels<Tonemapper::Filmic>(in, out, count); break;
+    }
+}
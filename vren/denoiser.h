@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <yocto/yocto_math.h>
+#include <yocto/yocto_image.h>
+
+#include "Film.h"
+#include "thread_pool.hpp"
+
+/*
+ CPU denoiser guided by the first hit AOVs.
+ Color is divided by albedo so textures survive, the remaining irradiance goes through a joint bilateral
+ filter whose weights come from the albedo, normal and depth buffers, then the albedo is multiplied back.
+ Works on independent tiles so it scales with the thread pool.
+*/
+class Denoiser {
+public:
+    int radius = 6;             // filter footprint in pixels
+    float sigmaSpatial = 3.0f;
+    float sigmaColor = 1.0f;    // on log luminance of the irradiance
+    float sigmaAlbedo = 0.1f;
+    float sigmaNormal = 0.1f;   // on 1 - dot(n, n')
+    float sigmaDepth = 0.05f;   // relative depth difference
+    int tileSize = 32;
+
+    // film must have AOVs enabled, image must be film.width x film.height
+    void Denoise(const Film& film, yocto::color_image& image, thread_pool* pool = nullptr) const {
+        const int width = film.width;
+        const int height = film.height;
+
+        std::vector<yocto::vec4f> color(width * height);
+        film.GetLinear(color.data());
+        std::vector<yocto::vec3f> albedo, normal;
+        std::vector<float> depth;
+        film.GetGuides(albedo, normal, depth);
+
+        // demodulate albedo, so the filter only blurs lighting
+        std::vector<yocto::vec3f> irradiance(width * height);
+        std::vector<float> logLum(width * height);
+        for (auto i = 0; i < width * height; i++) {
+            for (auto c = 0; c < 3; c++) {
+                irradiance[i][c] = color[i][c] / std::max(albedo[i][c], albedoEpsilon);
+            }
+            logLum[i] = std::log(1.0f + luminance(irradiance[i]));
+        }
+
+        std::vector<yocto::vec4f> denoised(width * height);
+        const int tilesX = (width + tileSize - 1) / tileSize;
+        const int tilesY = (height + tileSize - 1) / tileSize;
+        auto filterTiles = [&](int start, int end) {
+            for (auto t = start; t < end; t++) {
+                const int x0 = (t % tilesX) * tileSize;
+                const int y0 = (t / tilesX) * tileSize;
+                filterTile(x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height), width, height,
+                    irradiance, logLum, albedo, normal, depth, denoised);
+            }
+        };
+        if (pool)
+            pool->parallelize_loop(0, tilesX * tilesY, filterTiles);
+        else
+            filterTiles(0, tilesX * tilesY);
+
+        resolve_pixels(denoised.data(), image.pixels.data(), denoised.size(), film.tonemapper);
+    }
+
+private:
+    static constexpr float albedoEpsilon = 0.01f;
+
+    static float luminance(const yocto::vec3f& c) {
+        return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+    }
+
+    void filterTile(int x0, int y0, int x1, int y1, int width, int height,
+            const std::vector<yocto::vec3f>& irradiance, const std::vector<float>& logLum,
+            const std::vector<yocto::vec3f>& albedo, const std::vector<yocto::vec3f>& normal,
+            const std::vector<float>& depth, std::vector<yocto::vec4f>& out) const {
+        const float invSpatial = 1.0f / (2 * sigmaSpatial * sigmaSpatial);
+        const float invColor = 1.0f / (2 * sigmaColor * sigmaColor);
+        const float invAlbedo = 1.0f / (2 * sigmaAlbedo * sigmaAlbedo);
+        const float invNormal = 1.0f / sigmaNormal;
+        const float invDepth = 1.0f / sigmaDepth;
+
+        for (auto y = y0; y < y1; y++) {
+            for (auto x = x0; x < x1; x++) {
+                const auto center = y * width + x;
+                const auto& ca = albedo[center];
+                const auto& cn = normal[center];
+                const float cd = depth[center];
+                const float cl = logLum[center];
+
+                yocto::vec3f sum = { 0, 0, 0 };
+                float wsum = 0.0f;
+                for (auto ny = std::max(y - radius, 0); ny <= std::min(y + radius, height - 1); ny++) {
+                    for (auto nx = std::max(x - radius, 0); nx <= std::min(x + radius, width - 1); nx++) {
+                        const auto idx = ny * width + nx;
+                        const float dx = (float)(nx - x), dy = (float)(ny - y);
+                        const auto da = albedo[idx] - ca;
+                        const float dl = logLum[idx] - cl;
+                        // normals are unit length, or zero for the background, which only matches the background
+                        const bool bothBackground = yocto::dot(cn, cn) == 0.0f && yocto::dot(normal[idx], normal[idx]) == 0.0f;
+                        const float dn = bothBackground ? 0.0f : 1.0f - yocto::dot(normal[idx], cn);
+                        const float dd = std::abs(depth[idx] - cd) / std::max(cd, 1e-3f);
+
+                        const float w = std::exp(
+                            -(dx * dx + dy * dy) * invSpatial
+                            - dl * dl * invColor
+                            - yocto::dot(da, da) * invAlbedo
+                            - std::max(dn, 0.0f) * invNormal
+                            - dd * invDepth);
+                        sum += irradiance[idx] * w;
+                        wsum += w;
+                    }
+                }
+
+                // every term of the center pixel is 0, up to rounding, so its weight is 1 and wsum > 0
+                const auto filtered = sum / wsum;
+                out[center] = {
+                    filtered.x * std::max(ca.x, albedoEpsilon),
+                    filtered.y * std::max(ca.y, albedoEpsilon),
+                    filtered.z * std::max(ca.z, albedoEpsilon),
+                    1.0f
+                };
+            }
+        }
+    }
+};
\ No newline at end of file
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include <embree3/rtcore.h>
+
+#include "hittable_list.h"
+#include "model.h"
+#include "bvh_model.h"
+
+/*
+ Compiles a whole hittable_list into a single Embree scene, so a ray is intersected with one embree query
+ instead of walking the objects one after the other.
+ Meshes become triangle geometries. Other bounded objects become user geometries whose callbacks run the object's
+ own intersect() on the double precision ray, so they get the same hits as without Embree.
+ Objects without bounds (plane) can't be put in a BVH, they are intersected after the embree query.
+ Each geometry is attached with the index of its object as geometry ID, so hits resolve through the list.
+*/
+class embree_scene : public hittable {
+private:
+    // passed to the user geometry callbacks, it must start with embree's context
+    // the arrays are indexed by the embree ray's id, which is its lane in the query
+    struct query_context {
+        RTCIntersectContext context;
+        const ray* rays;              // double precision rays
+        const double* tmin;
+        hit_candidate* user_hits;     // closest hit found by user geometries
+    };
+
+    static void boundsFunc(const RTCBoundsFunctionArguments* args) {
+        const auto object = (const hittable*)args->geometryUserPtr;
+        point3 lo, hi;
+        object->bounding_box(lo, hi);
+        // round outwards so the float bounds still contain the object
+        const float inf = std::numeric_limits<float>::infinity();
+        auto* b = args->bounds_o;
+        b->lower_x = std::nextafter((float)lo.x(), -inf);
+        b->lower_y = std::nextafter((float)lo.y(), -inf);
+        b->lower_z = std::nextafter((float)lo.z(), -inf);
+        b->upper_x = std::nextafter((float)hi.x(), inf);
+        b->upper_y = std::nextafter((float)hi.y(), inf);
+        b->upper_z = std::nextafter((float)hi.z(), inf);
+    }
+
+    static void intersectFunc(const RTCIntersectFunctionNArguments* args) {
+        const auto object = (const hittable*)args->geometryUserPtr;
+        auto ctx = (query_context*)args->context;
+        RTCRayN* r = RTCRayHitN_RayN(args->rayhit, args->N);
+        RTCHitN* h = RTCRayHitN_HitN(args->rayhit, args->N);
+        for (unsigned i = 0; i < args->N; i++) {
+            if (args->valid[i] != -1) continue;
+
+            const unsigned lane = RTCRayN_id(r, args->N, i);
+            hit_candidate cand;
+            if (!object->intersect(ctx->rays[lane], ctx->tmin[lane], RTCRayN_tfar(r, args->N, i), cand)) continue;
+
+            RTCRayN_tfar(r, args->N, i) = (float)cand.t;
+            RTCHitN_u(h, args->N, i) = cand.u;
+            RTCHitN_v(h, args->N, i) = cand.v;
+            RTCHitN_primID(h, args->N, i) = args->primID;
+            RTCHitN_geomID(h, args->N, i) = args->geomID;
+            RTCHitN_instID(h, args->N, i, 0) = args->context->instID[0];
+            ctx->user_hits[lane] = cand;
+        }
+    }
+
+    static void occludedFunc(const RTCOccludedFunctionNArguments* args) {
+        const auto object = (const hittable*)args->geometryUserPtr;
+        auto ctx = (query_context*)args->context;
+        for (unsigned i = 0; i < args->N; i++) {
+            if (args->valid[i] != -1) continue;
+            const unsigned lane = RTCRayN_id(args->ray, args->N, i);
+            if (object->occluded(ctx->rays[lane], ctx->tmin[lane], RTCRayN_tfar(args->ray, args->N, i)))
+                RTCRayN_tfar(args->ray, args->N, i) = -std::numeric_limits<float>::infinity();
+        }
+    }
+
+    void addTriangles(const hittable& object, const yocto::scene_shape& shape) {
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+        auto* vertices = (float*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
+            3 * sizeof(float), shape.positions.size());
+        for (size_t i = 0; i < shape.positions.size(); i++) {
+            vertices[i * 3 + 0] = shape.positions[i].x;
+            vertices[i * 3 + 1] = shape.positions[i].y;
+            vertices[i * 3 + 2] = shape.positions[i].z;
+        }
+        auto* indices = (unsigned*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+            3 * sizeof(unsigned), shape.triangles.size());
+        for (size_t i = 0; i < shape.triangles.size(); i++) {
+            indices[i * 3 + 0] = shape.triangles[i].x;
+            indices[i * 3 + 1] = shape.triangles[i].y;
+            indices[i * 3 + 2] = shape.triangles[i].z;
+        }
+        rtcCommitGeometry(geom);
+        rtcAttachGeometryByID(scene, geom, object.id);
+        rtcReleaseGeometry(geom);
+    }
+
+    void addUserGeometry(const hittable& object) {
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+        rtcSetGeometryUserPrimitiveCount(geom, 1);
+        rtcSetGeometryUserData(geom, (void*)&object);
+        rtcSetGeometryBoundsFunction(geom, boundsFunc, nullptr);
+        rtcSetGeometryIntersectFunction(geom, intersectFunc);
+        rtcSetGeometryOccludedFunction(geom, occludedFunc);
+        rtcCommitGeometry(geom);
+        rtcAttachGeometryByID(scene, geom, object.id);
+        rtcReleaseGeometry(geom);
+        userGeometry[object.id] = 1;
+    }
+
+    static RTCRay toEmbree(const ray& r, double t_min, double t_max, unsigned lane = 0) {
+        RTCRay er;
+        er.org_x = (float)r.orig.x(); er.org_y = (float)r.orig.y(); er.org_z = (float)r.orig.z();
+        er.dir_x = (float)r.dir.x(); er.dir_y = (float)r.dir.y(); er.dir_z = (float)r.dir.z();
+        er.tnear = (float)t_min;
+        er.tfar = (float)t_max;
+        er.time = 0.0f;
+        er.mask = -1;
+        er.id = lane;
+        er.flags = 0;
+        return er;
+    }
+
+    // candidate of a hit found by embree, user geometries kept theirs in double precision
+    hit_candidate toCandidate(unsigned geomID, unsigned primID, float t, float u, float v, const hit_candidate& user) const {
+        hit_candidate cand = user;
+        if (!userGeometry[geomID]) cand = { t, u, v, (int)primID };
+        cand.object = (int)geomID;
+        return cand;
+    }
+
+public:
+    embree_scene(hittable_list& list) : hittable("embree_scene"), list(list), userGeometry(list.objects.size(), 0) {
+        device = rtcNewDevice(nullptr);
+        if (!device) throw std::runtime_error("failed to create the embree device");
+        scene = rtcNewScene(device);
+        rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_HIGH);
+
+        wall_timer timer;
+        point3 lo, hi;
+        for (const auto& object : list.objects) {
+            if (auto m = dynamic_cast<const model*>(object.get()))
+                addTriangles(*m, m->scene.shapes[0]);
+            else if (auto m = dynamic_cast<const BVHModel*>(object.get()))
+                addTriangles(*m, m->shape);
+            else if (object->bounding_box(lo, hi))
+                addUserGeometry(*object);
+            else
+                unbounded.push_back(object.get());
+        }
+        rtcCommitScene(scene);
+        total_bvh_build_seconds += timer.elapsed_seconds();
+    }
+
+    ~embree_scene() {
+        rtcReleaseScene(scene);
+        rtcReleaseDevice(device);
+    }
+
+    embree_scene(const embree_scene&) = delete;
+    embree_scene& operator=(const embree_scene&) = delete;
+
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const override {
+        RTCRayHit rh;
+        rh.ray = toEmbree(r, t_min, t_max);
+        rh.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        rh.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+
+        hit_candidate user;
+        query_context ctx{ {}, &r, &t_min, &user };
+        rtcInitIntersectContext(&ctx.context);
+        rtcIntersect1(scene, &ctx.context, &rh);
+
+        bool found = rh.hit.geomID != RTC_INVALID_GEOMETRY_ID;
+        if (found) cand = toCandidate(rh.hit.geomID, rh.hit.primID, rh.ray.tfar, rh.hit.u, rh.hit.v, user);
+
+        hit_candidate temp;
+        for (auto object : unbounded) {
+            if (object->intersect(r, t_min, found ? cand.t : t_max, temp)) {
+                cand = temp;
+                cand.object = object->id;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const override {
+        list.resolve(r, cand, rec);
+    }
+
+    // rays go through embree 8 at a time
+    virtual void intersect_batch(ray_batch& b) const override {
+        const int width = 8;
+        for (size_t start = 0; start < b.size(); start += width) {
+            const int count = (int)std::min(b.size() - start, (size_t)width);
+
+            alignas(32) int valid[width];
+            RTCRayHit8 rh;
+            ray rays[width];
+            double tmin[width];
+            hit_candidate user[width];
+            for (auto k = 0; k < width; k++) {
+                valid[k] = k < count ? -1 : 0;
+                if (k >= count) continue;
+
+                const auto i = start + k;
+                rays[k] = b.get(i);
+                tmin[k] = b.tmin[i];
+                const RTCRay er = toEmbree(rays[k], b.tmin[i], b.tmax[i], k);
+                rh.ray.org_x[k] = er.org_x; rh.ray.org_y[k] = er.org_y; rh.ray.org_z[k] = er.org_z;
+                rh.ray.dir_x[k] = er.dir_x; rh.ray.dir_y[k] = er.dir_y; rh.ray.dir_z[k] = er.dir_z;
+                rh.ray.tnear[k] = er.tnear;
+                rh.ray.tfar[k] = er.tfar;
+                rh.ray.time[k] = er.time;
+                rh.ray.mask[k] = er.mask;
+                rh.ray.id[k] = er.id;
+                rh.ray.flags[k] = er.flags;
+                rh.hit.geomID[k] = RTC_INVALID_GEOMETRY_ID;
+                rh.hit.instID[0][k] = RTC_INVALID_GEOMETRY_ID;
+            }
+
+            query_context ctx{ {}, rays, tmin, user };
+            rtcInitIntersectContext(&ctx.context);
+            rtcIntersect8(valid, scene, &ctx.context, &rh);
+
+            for (auto k = 0; k < count; k++) {
+                if (rh.hit.geomID[k] == RTC_INVALID_GEOMETRY_ID) continue;
+                b.setHit(start + k,
+                    toCandidate(rh.hit.geomID[k], rh.hit.primID[k], rh.ray.tfar[k], rh.hit.u[k], rh.hit.v[k], user[k]));
+            }
+        }
+
+        for (auto object : unbounded) object->intersect_batch(b);
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        RTCRay er = toEmbree(r, t_min, t_max);
+        hit_candidate user;
+        query_context ctx{ {}, &r, &t_min, &user };
+        rtcInitIntersectContext(&ctx.context);
+        rtcOccluded1(scene, &ctx.context, &er);
+        if (er.tfar < 0.0f) return true;
+
+        for (auto object : unbounded) {
+            if (object->occluded(r, t_min, t_max)) return true;
+        }
+        return false;
+    }
+
+    virtual double pdf_value(const point3& o, const vec3& v) const override {
+        return list.pdf_value(o, v);
+    }
+
+    virtual vec3 random(const point3& o, rnd& rng) override {
+        return list.random(o, rng);
+    }
+
+    virtual std::string pdf_name() const override {
+        return list.pdf_name();
+    }
+
+private:
+    hittable_list& list;
+    RTCDevice device;
+    RTCScene scene;
+    std::vector<uint8_t> userGeometry; // indexed by geometry ID
+    std::vector<const hittable*> unbounded;
+};
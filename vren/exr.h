@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/*
+ Minimal multi-channel OpenEXR writer.
+ yocto only saves RGBA images, so arbitrary layers (albedo.R, normal.X, id.object, ...) are written here as
+ an uncompressed scanline file. Assumes a little-endian host, like the rest of our binary formats.
+*/
+namespace exr {
+    enum class PixelType : int32_t { Uint = 0, Half = 1, Float = 2 };
+
+    struct channel {
+        std::string name; // layer.channel, e.g. "albedo.R"
+        PixelType type;
+        std::vector<uint32_t> data; // width x height values, raw bits of either uint32 or float32
+
+        channel(std::string name, const std::vector<float>& values) : name(name), type(PixelType::Float), data(values.size()) {
+            std::memcpy(data.data(), values.data(), values.size() * sizeof(float));
+        }
+
+        channel(std::string name, const std::vector<uint32_t>& values) : name(name), type(PixelType::Uint), data(values) {}
+    };
+
+    namespace detail {
+        template<typename T>
+        void write(std::ofstream& out, const T& v) {
+            out.write((const char*)&v, sizeof(T));
+        }
+
+        inline void write(std::ofstream& out, const std::string& s) {
+            out.write(s.c_str(), s.size() + 1);
+        }
+
+        inline void writeAttributeHeader(std::ofstream& out, const std::string& name, const std::string& type, int32_t size) {
+            write(out, name);
+            write(out, type);
+            write(out, size);
+        }
+    }
+
+    inline bool save(const std::string& filename, int width, int height, std::vector<channel> channels, std::string& error) {
+        using namespace detail;
+
+        for (const auto& c : channels) {
+            if (c.data.size() != (size_t)width * height) {
+                error = "channel " + c.name + " has the wrong size";
+                return false;
+            }
+        }
+        // EXR requires channels sorted by name
+        std::sort(channels.begin(), channels.end(),
+            [](const channel& a, const channel& b) { return a.name < b.name; });
+
+        std::ofstream out(filename, std::ios::out | std::ios::binary);
+        if (!out) {
+            error = "cannot create " + filename;
+            return false;
+        }
+
+        // magic number and version 2, single part scanline file
+        write(out, (int32_t)20000630);
+        write(out, (int32_t)2);
+
+        int32_t chlistSize = 1;
+        for (const auto& c : channels) chlistSize += (int32_t)c.name.size() + 1 + 16;
+        writeAttributeHeader(out, "channels", "chlist", chlistSize);
+        for (const auto& c : channels) {
+            write(out, c.name);
+            write(out, (int32_t)c.type);
+            write(out, (uint8_t)0); // pLinear
+            const uint8_t reserved[3] = { 0, 0, 0 };
+            out.write((const char*)reserved, 3);
+            write(out, (int32_t)1); // xSampling
+            write(out, (int32_t)1); // ySampling
+        }
+        write(out, (uint8_t)0);
+
+        writeAttributeHeader(out, "compression", "compression", 1);
+        write(out, (uint8_t)0); // NO_COMPRESSION
+        const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+        writeAttributeHeader(out, "dataWindow", "box2i", 16);
+        out.write((const char*)window, 16);
+        writeAttributeHeader(out, "displayWindow", "box2i", 16);
+        out.write((const char*)window, 16);
+        writeAttributeHeader(out, "lineOrder", "lineOrder", 1);
+        write(out, (uint8_t)0); // INCREASING_Y
+        writeAttributeHeader(out, "pixelAspectRatio", "float", 4);
+        write(out, 1.0f);
+        writeAttributeHeader(out, "screenWindowCenter", "v2f", 8);
+        write(out, 0.0f);
+        write(out, 0.0f);
+        writeAttributeHeader(out, "screenWindowWidth", "float", 4);
+        write(out, 1.0f);
+        write(out, (uint8_t)0); // end of header
+
+        // uncompressed files store one scanline per block
+        const int32_t blockSize = (int32_t)(channels.size() * width * 4);
+        uint64_t offset = (uint64_t)out.tellp() + sizeof(uint64_t) * height;
+        for (auto y = 0; y < height; y++) {
+            write(out, offset);
+            offset += 8 + blockSize;
+        }
+
+        for (auto y = 0; y < height; y++) {
+            write(out, (int32_t)y);
+            write(out, blockSize);
+            for (const auto& c : channels) {
+                out.write((const char*)&c.data[(size_t)y * width], width * 4);
+            }
+        }
+
+        if (!out) {
+            error = "failed to write " + filename;
+            return false;
+        }
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+enum class FilterType { Box, Gaussian, Mitchell, BlackmanHarris };
+
+/*
+ Separable pixel reconstruction filter.
+ The 1D filter is tabulated once over [0, radius] so splatting a sample only costs two table lookups per pixel.
+*/
+class Filter {
+private:
+    static const int tableSize = 64;
+    std::vector<float> table;
+
+    static float mitchell1D(float x) {
+        // B = C = 1/3, x in [0, 2]
+        const float B = 1.0f / 3.0f;
+        const float C = 1.0f / 3.0f;
+        if (x > 1.0f) {
+            return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+                (-12 * B - 48 * C) * x + (8 * B + 24 * C)) * (1.0f / 6.0f);
+        }
+        return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x +
+            (6 - 2 * B)) * (1.0f / 6.0f);
+    }
+
+    // evaluates the 1D filter at offset x in [0, radius]
+    float evaluate(float x) const {
+        switch (type) {
+        case FilterType::Gaussian: {
+            const float alpha = 2.0f;
+            return std::max(0.0f, std::exp(-alpha * x * x) - std::exp(-alpha * radius * radius));
+        }
+        case FilterType::Mitchell:
+            return mitchell1D(2.0f * x / radius);
+        case FilterType::BlackmanHarris: {
+            // window spans [-radius, radius], remap to [0, 1]
+            const float a0 = 0.35875f, a1 = 0.48829f, a2 = 0.14128f, a3 = 0.01168f;
+            const float twoPi = 6.28318530718f;
+            float t = 0.5f + 0.5f * x / radius;
+            return a0 - a1 * std::cos(twoPi * t) + a2 * std::cos(2 * twoPi * t) - a3 * std::cos(3 * twoPi * t);
+        }
+        case FilterType::Box:
+        default:
+            return 1.0f;
+        }
+    }
+
+public:
+    const FilterType type;
+    const float radius;
+
+    Filter(FilterType type = FilterType::Box, float radius = 0.5f) : table(tableSize), type(type), radius(radius) {
+        for (auto i = 0; i < tableSize; i++) {
+            table[i] = evaluate((i + 0.5f) * radius / tableSize);
+        }
+    }
+
+    static float defaultRadius(FilterType type) {
+        switch (type) {
+        case FilterType::Gaussian: return 1.5f;
+        case FilterType::Mitchell: return 2.0f;
+        case FilterType::BlackmanHarris: return 2.0f;
+        case FilterType::Box:
+        default: return 0.5f;
+        }
+    }
+
+    // a box filter that doesn't extend past the pixel is the same as averaging the pixel's samples
+    bool isPixelBox() const {
+        return type == FilterType::Box && radius <= 0.5f;
+    }
+
+    // (dx, dy) is the offset from the pixel center to the sample, both in [-radius, radius]
+    float Evaluate(float dx, float dy) const {
+        int ix = std::min((int)(std::abs(dx) / radius * tableSize), tableSize - 1);
+        int iy = std::min((int)(std::abs(dy) / radius * tableSize), tableSize - 1);
+        return table[ix] * table[iy];
+    }
+};
\ No newline at end of file
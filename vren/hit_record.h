@@ -6,6 +6,15 @@
 class material;
 class hittable;
 
+// what traversal returns for a candidate hit, the hit_record is only computed for the closest one
+struct hit_candidate {
+    double t;
+    float u, v;         // barycentrics for meshes
+    int element = -1;   // primitive id
+    int object = -1;    // index of the hit object in its hittable_list, which is why lists can't be nested:
+                        // each level would overwrite it with its own index
+};
+
 struct hit_record {
     point3 p;
     vec3 normal;
@@ -2,12 +2,49 @@
 
 #include "ray.h"
 #include "hit_record.h"
+#include "ray_batch.h"
 
 class hittable {
 public:
     hittable(std::string n) :name(n) {}
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+    // closest hit in [t_min, t_max], only computes what's needed to find it
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const = 0;
+
+    // computes the surface interaction of a candidate returned by intersect()
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const = 0;
+
+    // intersects every ray of the batch, only records hits closer than the ray's tmax and sets their object to id
+    // the default goes through intersect() one ray at a time
+    // hit_candidate::object only holds one index, so the objects of a hittable_list can't be lists themselves
+    virtual void intersect_batch(ray_batch& batch) const {
+        hit_candidate cand;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (intersect(batch.get(i), batch.tmin[i], batch.tmax[i], cand)) {
+                cand.object = id;
+                batch.setHit(i, cand);
+            }
+        }
+    }
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+        hit_candidate cand;
+        if (!intersect(r, t_min, t_max, cand))
+            return false;
+        resolve(r, cand, rec);
+        return true;
+    }
+
+    // true if anything is hit in [t_min, t_max]. Doesn't need to find the closest hit nor compute its attributes
+    virtual bool occluded(const ray& r, double t_min, double t_max) const {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
+
+    // axis aligned bounds of the object, false if it's unbounded
+    virtual bool bounding_box(point3& lo, point3& hi) const {
+        return false;
+    }
 
     virtual double pdf_value(const point3& o, const vec3& v) const {
         return 0.0;
@@ -22,4 +59,5 @@ public:
     }
 
     std::string name;
+    int id = -1; // index in the owning hittable_list, used as object ID in AOVs
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <vector>
+#include <stdexcept>
 
 using std::shared_ptr;
 using std::make_shared;
@@ -17,9 +18,29 @@ public:
     hittable_list(shared_ptr<hittable> object): hittable("list") { add(object); }
 
     void clear() { objects.clear(); }
-    void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    // hits only keep the index of their object in the list, a nested list would lose the index of its own object
+    void add(shared_ptr<hittable> object) {
+        if (dynamic_cast<hittable_list*>(object.get()))
+            throw std::invalid_argument("hittable_list can't be nested, add the objects of the inner list instead");
+        object->id = (int)objects.size();
+        objects.push_back(object);
+    }
+
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const override;
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const override;
+
+    // each object only keeps the hits that are closer than the previous objects'
+    virtual void intersect_batch(ray_batch& batch) const override {
+        for (const auto& object : objects) object->intersect_batch(batch);
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, t_min, t_max)) return true;
+        }
+        return false;
+    }
 
     virtual double pdf_value(const vec3& o, const vec3& v) const override {
         auto weight = 1.0 / objects.size();
@@ -44,19 +65,25 @@ public:
     std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
+bool hittable_list::intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const {
+    hit_candidate temp;
     bool hit_anything = false;
     auto closest_so_far = t_max;
 
-    for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+    for (auto i = 0; i < objects.size(); i++) {
+        if (objects[i]->intersect(r, t_min, closest_so_far, temp)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
-            rec.obj_ptr = object.get();
+            closest_so_far = temp.t;
+            cand = temp;
+            cand.object = i;
         }
     }
 
     return hit_anything;
+}
+
+void hittable_list::resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const {
+    const auto& object = objects[cand.object];
+    object->resolve(r, cand, rec);
+    rec.obj_ptr = object.get();
 }
\ No newline at end of file
@@ -24,6 +24,8 @@
 #include <yocto/yocto_cli.h>
 
 #include "pathtracer.h"
+#include "denoiser.h"
+#include "embree_scene.h"
 
 using namespace std;
 
@@ -39,6 +41,14 @@ struct app_params {
     bool save_reference = false;
     string sss = "Apple";
     float sss_scale = 1.0f;
+    string tonemap = "gamma";
+    string filter = "box";
+    float filter_radius = 0.0f;
+    bool aovs = false;
+    bool denoise = false;
+    bool sort_rays = false;
+    bool embree_scene = false;
+    bool pin_threads = false;
 };
 
 void parse_cli(app_params& params, int argc, const char** argv) {
@@ -57,9 +67,39 @@ void parse_cli(app_params& params, int argc, const char** argv) {
     yocto::add_option(cli, "save_ref", params.save_reference, "Save Reference as reference.raw");
     yocto::add_option(cli, "sss", params.sss, "Subsufrace Scatteting material name.");
     yocto::add_option(cli, "sss_scale", params.sss_scale, "Subsufrace Scatteting Scale.");
+    yocto::add_option(cli, "tonemap", params.tonemap, "Tonemapper [linear, gamma, aces, filmic].");
+    yocto::add_option(cli, "filter", params.filter, "Reconstruction filter [box, gaussian, mitchell, blackman-harris].");
+    yocto::add_option(cli, "filter_radius", params.filter_radius, "Filter radius in pixels, 0 uses the filter's default.");
+    yocto::add_option(cli, "aovs", params.aovs, "Save albedo, normal, depth and ID buffers to a multi-layer EXR.");
+    yocto::add_option(cli, "denoise", params.denoise, "Also save a denoised image.");
+    yocto::add_option(cli, "sort_rays", params.sort_rays, "Sort secondary rays by coherence before intersecting them.");
+    yocto::add_option(cli, "embree_scene", params.embree_scene, "Intersect the whole scene with a single Embree scene.");
+    yocto::add_option(cli, "pin_threads", params.pin_threads, "Pin render threads to cores and place the film on their NUMA nodes.");
     yocto::parse_cli(cli, argc, argv);
 }
 
+Tonemapper parse_tonemapper(const string& name) {
+    if (name == "linear") return Tonemapper::Linear;
+    if (name == "gamma") return Tonemapper::Gamma;
+    if (name == "aces") return Tonemapper::ACES;
+    if (name == "filmic") return Tonemapper::Filmic;
+    yocto::print_fatal("Unknown tonemapper " + name);
+    // print_fatal() exits, the cli's default keeps the function well defined if it ever doesn't
+    return Tonemapper::Gamma;
+}
+
+Filter parse_filter(const string& name, float radius) {
+    // print_fatal() exits, the cli's default keeps type initialized if it ever doesn't
+    FilterType type = FilterType::Box;
+    if (name == "box") type = FilterType::Box;
+    else if (name == "gaussian") type = FilterType::Gaussian;
+    else if (name == "mitchell") type = FilterType::Mitchell;
+    else if (name == "blackman-harris") type = FilterType::BlackmanHarris;
+    else yocto::print_fatal("Unknown filter " + name);
+
+    return Filter(type, radius > 0.0f ? radius : Filter::defaultRadius(type));
+}
+
 void dragon_scene(hittable_list& objects, const app_params& params) {
     auto material_ground = make_shared<lambertian>(color(0.6));
     objects.add(make_shared<plane>("floor", point3(0.0, 0.1, 0.0), vec3(0.0, 1.0, 0.0), material_ground));
@@ -107,6 +147,14 @@ void parallel_render(tracer& pt, const app_params& params, int pass) {
         pt.Render(params.samples_per_iter);
         yocto::print_progress_next();
     }
+
+#ifdef VREN_PROFILER
+    auto& profile = profiler::registry::get();
+    profile.printBreakdown(std::cerr);
+    profile.resetStages();
+    if (!profile.saveChromeTrace(params.output + "_trace.json"))
+        yocto::print_info("WARNING! failed to save " + params.output + "_trace.json");
+#endif
 }
 
 int main(int argc, const char* argv[]) {
@@ -150,7 +198,10 @@ int main(int argc, const char* argv[]) {
     vec3 vup{ 0, 1, 0 };
 
     camera cam{ lookfrom, lookat, vup, vfov, aspect_ratio, aperture };
-    auto film = Film(image_width, image_height);
+    auto film = Film(image_width, image_height, parse_filter(params.filter, params.filter_radius));
+    film.tonemapper = parse_tonemapper(params.tonemap);
+    // the denoiser is guided by the aovs
+    if (params.aovs || params.denoise) film.EnableAOVs();
 
     unique_ptr<EnvMap> envmap = nullptr;
     if (use_envmap) {
@@ -158,14 +209,19 @@ int main(int argc, const char* argv[]) {
         envmap = make_unique<EnvMap>(hdr_filename);
     }
 
+    unique_ptr<embree_scene> accel = nullptr;
+    if (params.embree_scene) accel = make_unique<embree_scene>(world);
+
     // Render
     scene_desc scene{
         background,
-        world,
+        accel ? (hittable&)*accel : world,
         envmap.get()
     };
     unsigned rr_depth = russian_roulette ? 3 : max_depth;
     pathtracer pt{ cam, film, scene, max_depth, rr_depth };
+    pt.SetRaySorting(params.sort_rays);
+    if (params.pin_threads) pt.PinThreads();
     if (!russian_roulette)
         yocto::print_info("WARNING! Russian Roulette is disabled");
 
@@ -186,6 +242,38 @@ int main(int argc, const char* argv[]) {
         save_image(image, params.output + ".png");
     }
 
+    if (params.denoise) {
+        yocto::print_progress_begin("Denoising");
+        thread_pool pool;
+        auto image = yocto::make_image(film.width, film.height, false);
+        Denoiser{}.Denoise(film, image, &pool);
+        yocto::print_progress_end();
+        save_image(image, params.output + "_denoised.png");
+    }
+
+    if (params.aovs) {
+        auto error = string{};
+        if (!film.SaveAOVs(params.output + "_aovs.exr", error))
+            yocto::print_fatal("Failed to save AOVs: " + error);
+#ifdef VREN_BVH_STATS
+        auto heatmap = yocto::make_image(film.width, film.height, false);
+        film.GetTraversalHeatmap(heatmap);
+        save_image(heatmap, params.output + "_heatmap.png");
+#endif
+    }
+
+#ifdef VREN_BVH_STATS
+    {
+        const auto traversal = pt.GetStats().traversal;
+        const double n = std::max((double)traversal.rays, 1.0);
+        yocto::print_info("BVHAccel rays = " + std::to_string(traversal.rays) +
+            ", nodes/ray = " + std::to_string(traversal.nodes / n) +
+            ", leaves/ray = " + std::to_string(traversal.leaves / n) +
+            ", triangles/ray = " + std::to_string(traversal.triangles / n) +
+            ", max stack = " + std::to_string(traversal.max_stack));
+    }
+#endif
+
     if (params.save_reference) {
         RawData raw(film.width, film.height);
         film.GetRaw(raw);
@@ -5,8 +5,10 @@
 #include "texture.h"
 #include "onb.h"
 #include "pdf.h"
+#include "hit_record.h"
+#include "material_kernels.h"
 
-struct hit_record;
+#include <vector>
 
 struct scatter_record {
     ray specular_ray;
@@ -17,6 +19,52 @@ struct scatter_record {
     Medium* medium_ptr = nullptr;
 };
 
+// hits scattered together by the same material, the kernels read the structure of arrays copy of the hits
+struct scatter_batch {
+    // inputs
+    std::vector<const ray*> in;
+    std::vector<const hit_record*> recs;
+    std::vector<rnd*> rngs;
+    std::vector<double> dx, dy, dz; // incoming direction
+    std::vector<double> nx, ny, nz; // normal, facing the incoming ray
+    std::vector<uint8_t> front_face;
+    // outputs
+    std::vector<scatter_record> srecs;
+    std::vector<uint8_t> scatters;
+    // scratch lanes of the material kernels, they live with the batch so the kernels don't allocate
+    std::vector<double> sx, sy, sz;  // random points in the unit sphere
+    std::vector<double> rand, reflectance;
+    std::vector<uint8_t> cannot_refract, refracted;
+    std::vector<double> ox, oy, oz;  // scattered direction
+
+    size_t size() const { return in.size(); }
+
+    void resize(size_t size) {
+        in.resize(size);
+        recs.resize(size);
+        rngs.resize(size);
+        for (auto v : { &dx, &dy, &dz, &nx, &ny, &nz }) v->resize(size);
+        front_face.resize(size);
+        srecs.resize(size);
+        scatters.resize(size);
+        for (auto v : { &sx, &sy, &sz, &rand, &reflectance, &ox, &oy, &oz }) v->resize(size);
+        cannot_refract.resize(size);
+        refracted.resize(size);
+    }
+
+    // also clears the lane's outputs
+    void set(size_t i, const ray& r, const hit_record& rec, rnd& rng) {
+        in[i] = &r;
+        recs[i] = &rec;
+        rngs[i] = &rng;
+        dx[i] = r.dir.x(); dy[i] = r.dir.y(); dz[i] = r.dir.z();
+        nx[i] = rec.normal.x(); ny[i] = rec.normal.y(); nz[i] = rec.normal.z();
+        front_face[i] = rec.front_face;
+        srecs[i] = {};
+        scatters[i] = 0;
+    }
+};
+
 class material {
 public:
     virtual color emitted(const ray& in, const hit_record& rec, double u, double v, const point3& p) const {
@@ -30,6 +78,12 @@ public:
     virtual double scattering_pdf(const ray& in, const hit_record& rec, const ray& scattered) const {
         return 0;
     }
+
+    // same as calling scatter() on every hit of the batch
+    virtual void scatter(scatter_batch& b) const {
+        for (auto i = 0; i < b.size(); ++i)
+            b.scatters[i] = scatter(*b.in[i], *b.recs[i], b.srecs[i], *b.rngs[i]);
+    }
 };
 
 /*
@@ -88,6 +142,23 @@ public:
         return (dot(reflected, rec.normal) > 0);
     }
 
+    virtual void scatter(scatter_batch& b) const override {
+        const int count = (int)b.size();
+        for (auto i = 0; i < count; ++i) {
+            const vec3 s = b.rngs[i]->random_in_unit_sphere();
+            b.sx[i] = s.x(); b.sy[i] = s.y(); b.sz[i] = s.z();
+        }
+        kernels::metal_scatter(count, fuzz, b.dx.data(), b.dy.data(), b.dz.data(), b.nx.data(), b.ny.data(), b.nz.data(),
+            b.sx.data(), b.sy.data(), b.sz.data(), b.ox.data(), b.oy.data(), b.oz.data(), b.scatters.data());
+        for (auto i = 0; i < count; ++i) {
+            auto& srec = b.srecs[i];
+            srec.specular_ray = ray{ b.recs[i]->p, vec3(b.ox[i], b.oy[i], b.oz[i]) };
+            srec.attenuation = albedo;
+            srec.is_specular = true;
+            srec.pdf_ptr = nullptr;
+        }
+    }
+
     color albedo;
     double fuzz;
 };
@@ -123,6 +194,27 @@ public:
         return true;
     }
 
+    virtual void scatter(scatter_batch& b) const override {
+        const int count = (int)b.size();
+        kernels::dielectric_reflectance(count, ir, b.dx.data(), b.dy.data(), b.dz.data(),
+            b.nx.data(), b.ny.data(), b.nz.data(), b.front_face.data(), b.cannot_refract.data(), b.reflectance.data());
+        // scatter() only draws a number when the ray can refract
+        for (auto i = 0; i < count; ++i) b.rand[i] = b.cannot_refract[i] ? 0.0 : b.rngs[i]->random_double();
+        kernels::dielectric_scatter(count, ir, b.dx.data(), b.dy.data(), b.dz.data(),
+            b.nx.data(), b.ny.data(), b.nz.data(), b.front_face.data(), b.cannot_refract.data(), b.reflectance.data(),
+            b.rand.data(), b.ox.data(), b.oy.data(), b.oz.data(), b.refracted.data());
+        for (auto i = 0; i < count; ++i) {
+            auto& srec = b.srecs[i];
+            srec.is_specular = true;
+            srec.pdf_ptr = nullptr;
+            srec.attenuation = color{ 1.0, 1.0, 1.0 };
+            srec.medium_ptr = medium.get();
+            srec.is_refracted = b.refracted[i];
+            srec.specular_ray = ray{ b.recs[i]->p, vec3(b.ox[i], b.oy[i], b.oz[i]) };
+            b.scatters[i] = true;
+        }
+    }
+
     double ir; // Index of Refraction
     std::shared_ptr<Medium> medium;
 
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+
+/*
+ Material and medium kernels over structure of arrays data, one lane per hit.
+ Loops don't branch so the compiler can vectorize them, build with VREN_NATIVE_ARCH to let it use the widest
+ SIMD instructions of the host. Random numbers are drawn by the callers in the same order as the scalar
+ materials draw them, so a path's random sequence doesn't depend on how it was shaded.
+*/
+namespace kernels {
+    // Schlick's approximation, the power is expanded so the loop doesn't call pow()
+    inline double schlick(double cosine, double ref_idx) {
+        auto r0 = (1 - ref_idx) / (1 + ref_idx);
+        r0 = r0 * r0;
+        const double c = 1 - cosine;
+        const double c2 = c * c;
+        return r0 + (1 - r0) * c2 * c2 * c;
+    }
+
+    // first half of dielectric::scatter(), up to the random number it draws when the ray can refract
+    inline void dielectric_reflectance(int count, double ir,
+            const double* dx, const double* dy, const double* dz,
+            const double* nx, const double* ny, const double* nz, const uint8_t* front_face,
+            uint8_t* cannot_refract, double* reflectance) {
+        for (auto i = 0; i < count; i++) {
+            const double ratio = front_face[i] ? (1.0 / ir) : ir;
+            const double cos_theta = std::min(-dx[i] * nx[i] - dy[i] * ny[i] - dz[i] * nz[i], 1.0);
+            const double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+            cannot_refract[i] = ratio * sin_theta > 1.0;
+            reflectance[i] = schlick(cos_theta, ir);
+        }
+    }
+
+    // second half of dielectric::scatter(), rand is only read for the lanes that can refract
+    // computes both the reflected and refracted directions and keeps one
+    inline void dielectric_scatter(int count, double ir,
+            const double* dx, const double* dy, const double* dz,
+            const double* nx, const double* ny, const double* nz, const uint8_t* front_face,
+            const uint8_t* cannot_refract, const double* reflectance, const double* rand,
+            double* ox, double* oy, double* oz, uint8_t* refracted) {
+        for (auto i = 0; i < count; i++) {
+            const double ratio = front_face[i] ? (1.0 / ir) : ir;
+            const double d_n = dx[i] * nx[i] + dy[i] * ny[i] + dz[i] * nz[i];
+
+            const double rx = dx[i] - 2 * d_n * nx[i];
+            const double ry = dy[i] - 2 * d_n * ny[i];
+            const double rz = dz[i] - 2 * d_n * nz[i];
+
+            const double cos_theta = std::min(-d_n, 1.0);
+            const double px = ratio * (dx[i] + cos_theta * nx[i]);
+            const double py = ratio * (dy[i] + cos_theta * ny[i]);
+            const double pz = ratio * (dz[i] + cos_theta * nz[i]);
+            const double parallel = -std::sqrt(std::max(1.0 - (px * px + py * py + pz * pz), 0.0));
+            const double tx = px + parallel * nx[i];
+            const double ty = py + parallel * ny[i];
+            const double tz = pz + parallel * nz[i];
+
+            const bool reflect = cannot_refract[i] || reflectance[i] > rand[i];
+            ox[i] = reflect ? rx : tx;
+            oy[i] = reflect ? ry : ty;
+            oz[i] = reflect ? rz : tz;
+            refracted[i] = !reflect;
+        }
+    }
+
+    // metal::scatter(), (sx, sy, sz) are the random points in the unit sphere used to fuzz the reflection
+    inline void metal_scatter(int count, double fuzz,
+            const double* dx, const double* dy, const double* dz,
+            const double* nx, const double* ny, const double* nz,
+            const double* sx, const double* sy, const double* sz,
+            double* ox, double* oy, double* oz, uint8_t* scatters) {
+        for (auto i = 0; i < count; i++) {
+            const double d_n = dx[i] * nx[i] + dy[i] * ny[i] + dz[i] * nz[i];
+            const double rx = dx[i] - 2 * d_n * nx[i];
+            const double ry = dy[i] - 2 * d_n * ny[i];
+            const double rz = dz[i] - 2 * d_n * nz[i];
+            ox[i] = rx + fuzz * sx[i];
+            oy[i] = ry + fuzz * sy[i];
+            oz[i] = rz + fuzz * sz[i];
+            scatters[i] = rx * nx[i] + ry * ny[i] + rz * nz[i] > 0;
+        }
+    }
+
+    // HomogeneousMedium::SampleDistance(), r1 picks the channel and r2 the distance
+    // (tr, tg, tb) receive the beam transmittance divided by the sampling pdf
+    inline void medium_distance(int count, const double sigma_t[3], const double sigma_s[3],
+            const double* tMax, const double* r1, const double* r2,
+            double* distance, double* tr, double* tg, double* tb) {
+        for (auto i = 0; i < count; i++) {
+            const int channel = std::min((int)(r1[i] * 3), 2);
+            const double st = channel == 0 ? sigma_t[0] : (channel == 1 ? sigma_t[1] : sigma_t[2]);
+            const double dist = std::min(-std::log(1 - r2[i]) / st, tMax[i]);
+            const bool sampledMedium = dist < tMax[i];
+
+            const double Tr0 = std::exp(-sigma_t[0] * dist);
+            const double Tr1 = std::exp(-sigma_t[1] * dist);
+            const double Tr2 = std::exp(-sigma_t[2] * dist);
+
+            double pdf = sampledMedium ? (sigma_t[0] * Tr0 + sigma_t[1] * Tr1 + sigma_t[2] * Tr2) : (Tr0 + Tr1 + Tr2);
+            pdf *= 1 / 3.0;
+            pdf = pdf == 0 ? 1.0 : pdf;
+
+            const double invPdf = 1 / pdf;
+            distance[i] = dist;
+            tr[i] = invPdf * (sampledMedium ? Tr0 * sigma_s[0] : Tr0);
+            tg[i] = invPdf * (sampledMedium ? Tr1 * sigma_s[1] : Tr1);
+            tb[i] = invPdf * (sampledMedium ? Tr2 * sigma_s[2] : Tr2);
+        }
+    }
+}
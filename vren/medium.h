@@ -1,7 +1,31 @@
 #pragma once
 
+#include <vector>
+
 #include "rtweekend.h"
 #include "rnd.h"
+#include "material_kernels.h"
+
+// distances sampled for many rays inside the same medium, in structure of arrays layout
+struct distance_batch {
+    // inputs
+    std::vector<double> tMax;
+    std::vector<rnd*> rngs;
+    // outputs
+    std::vector<double> distance;
+    std::vector<double> tr, tg, tb; // beam transmittance
+    // random numbers of the kernels, they live with the batch so the kernels don't allocate
+    std::vector<double> r1, r2;
+
+    size_t size() const { return tMax.size(); }
+
+    void resize(size_t size) {
+        for (auto v : { &tMax, &distance, &tr, &tg, &tb, &r1, &r2 }) v->resize(size);
+        rngs.resize(size);
+    }
+
+    vec3 transmission(size_t i) const { return { tr[i], tg[i], tb[i] }; }
+};
 
 class Medium {
 public:
@@ -12,6 +36,16 @@ public:
         return { 1.0, 1.0, 1.0 };
     }
 
+    // same as calling SampleDistance() on every ray of the batch
+    virtual void SampleDistance(distance_batch& b) const {
+        for (auto i = 0; i < b.size(); ++i) {
+            const vec3 t = SampleDistance(b.tMax[i], b.distance[i], *b.rngs[i]);
+            b.tr[i] = t.x();
+            b.tg[i] = t.y();
+            b.tb[i] = t.z();
+        }
+    }
+
     virtual void SampleDirection(const vec3 &wo, vec3 &wi, rnd&rng) const {
         wi = wo;
     }
@@ -40,7 +74,7 @@ public:
     HomogeneousMedium(const vec3& sigma_a, const vec3& sigma_s) :
         sigma_a(sigma_a), sigma_s(sigma_s), sigma_t(sigma_a + sigma_s) {}
 
-    virtual vec3 SampleDistance(const double tMax, double& distance, rnd& rng) const {
+    virtual vec3 SampleDistance(const double tMax, double& distance, rnd& rng) const override {
         // Sample a channel and distance along the ray
         auto channel = std::min((int)(rng.random_double() * 3), 2);
         double dist = -std::log(1 - rng.random_double()) / sigma_t[channel];
@@ -61,6 +95,18 @@ public:
         return sampledMedium ? (Tr * sigma_s / pdf) : (Tr / pdf);
     }
 
+    virtual void SampleDistance(distance_batch& b) const override {
+        const int count = (int)b.size();
+        for (auto i = 0; i < count; ++i) {
+            b.r1[i] = b.rngs[i]->random_double();
+            b.r2[i] = b.rngs[i]->random_double();
+        }
+        const double st[3] = { sigma_t[0], sigma_t[1], sigma_t[2] };
+        const double ss[3] = { sigma_s[0], sigma_s[1], sigma_s[2] };
+        kernels::medium_distance(count, st, ss, b.tMax.data(), b.r1.data(), b.r2.data(),
+            b.distance.data(), b.tr.data(), b.tg.data(), b.tb.data());
+    }
+
     virtual void SampleDirection(const vec3& wo, vec3& wi, rnd& rng) const {
         wi = rng.random_in_unit_sphere();
     }
@@ -4,7 +4,6 @@
 #include <memory>
 #include <exception>
 #include <iostream>
-#include <time.h>
 
 #include <yocto/yocto_shape.h>
 #include <yocto/yocto_scene.h>
@@ -17,12 +16,15 @@
 
 #include "hittable.h"
 #include "rnd.h"
+#include "stats.h"
 
 class model : public hittable {
 private:
     void buildBvh(bool embree) {
         yocto::print_progress_begin("Build BVH");
+        wall_timer timer;
         bvh = yocto::make_bvh(scene, true, embree);
+        total_bvh_build_seconds += timer.elapsed_seconds();
         yocto::print_progress_end();
     }
 
@@ -82,7 +84,7 @@ public:
         setup(shape, frame, embree, subdivisions, catmullclark);
     }
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const override {
         auto ray = yocto::ray3f{ 
             toYocto(r.origin()), 
             toYocto(r.direction()),
@@ -93,25 +95,58 @@ public:
         if (!isec.hit)
             return false;
 
-        const yocto::scene_instance& instance = scene.instances[isec.instance];
+        cand.t = isec.distance;
+        cand.u = isec.uv.x;
+        cand.v = isec.uv.y;
+        cand.element = isec.element;
+        return true;
+    }
+
+    // yocto doesn't expose embree's stream queries, but this still skips the ray conversions of the default
+    virtual void intersect_batch(ray_batch& b) const override {
+        for (size_t i = 0; i < b.size(); i++) {
+            auto ray = yocto::ray3f{
+                { (float)b.ox[i], (float)b.oy[i], (float)b.oz[i] },
+                { (float)b.dx[i], (float)b.dy[i], (float)b.dz[i] },
+                (float)b.tmin[i],
+                (float)b.tmax[i]
+            };
+            auto isec = yocto::intersect_bvh(bvh, scene, ray);
+            if (isec.hit) b.setHit(i, { isec.distance, isec.uv.x, isec.uv.y, isec.element, id });
+        }
+    }
+
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const override {
+        // setup() creates a single instance
+        const yocto::scene_instance& instance = scene.instances[0];
+        const yocto::vec2f uv = { cand.u, cand.v };
 
-        rec.t = isec.distance;
+        rec.t = cand.t;
 
         // first compute geometric normal
-        auto outward_normal = yocto::eval_normal(scene, instance, isec.element, isec.uv);
+        auto outward_normal = yocto::eval_normal(scene, instance, cand.element, uv);
         rec.set_face_normal(r, fromYocto(outward_normal));
 
         // then compute intersection point using uv coordinates to reduce floating point imprecision effects
-        auto p = yocto::eval_position(scene, instance, isec.element, isec.uv);
+        auto p = yocto::eval_position(scene, instance, cand.element, uv);
         //rec.p = fromYocto(yocto::offset_ray(p, outward_normal));
         rec.p = fromYocto(p);
 
-        rec.u = isec.uv.x;
-        rec.v = isec.uv.y;
-        rec.element = isec.element;
+        rec.u = cand.u;
+        rec.v = cand.v;
+        rec.element = cand.element;
         rec.mat_ptr = mat_ptr.get();
+    }
 
-        return true;
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        auto ray = yocto::ray3f{
+            toYocto(r.origin()),
+            toYocto(r.direction()),
+            (float)t_min,
+            (float)t_max
+        };
+        // find_any lets yocto (and embree) stop at the first hit
+        return yocto::intersect_bvh(bvh, scene, ray, true).hit;
     }
 
     yocto::scene_model scene;
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <memory>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+/*
+ NUMA topology and thread pinning, used by pathtracer::PinThreads().
+ Memory pages are placed on the node of the thread that writes them first, so buffers that are mostly
+ accessed by the threads of one node are allocated with untouched_allocator and cleared by those threads.
+ Only Linux and Windows are supported, elsewhere the machine is a single node and threads are not pinned.
+*/
+namespace numa {
+    struct topology {
+        std::vector<std::vector<int>> nodes; // cpus of each node
+        std::vector<int> cpuNode;            // node of each cpu, -1 if the cpu isn't in any node
+
+        int nodeOf(int cpu) const {
+            return cpu >= 0 && cpu < (int)cpuNode.size() && cpuNode[cpu] >= 0 ? cpuNode[cpu] : 0;
+        }
+
+        // cpus ordered by node, so consecutive threads are spread over as few nodes as possible
+        std::vector<int> cpus() const {
+            std::vector<int> all;
+            for (const auto& n : nodes) all.insert(all.end(), n.begin(), n.end());
+            return all;
+        }
+
+        static topology detect() {
+            topology t;
+#if defined(__linux__)
+            for (int n = 0;; n++) {
+                std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+                if (!in) break;
+                std::string list;
+                std::getline(in, list);
+                // memory only nodes have no cpus
+                auto cpus = parseCpuList(list);
+                if (!cpus.empty()) t.nodes.push_back(cpus);
+            }
+#elif defined(_WIN32)
+            ULONG highest = 0;
+            if (GetNumaHighestNodeNumber(&highest)) {
+                for (ULONG n = 0; n <= highest; n++) {
+                    ULONGLONG mask = 0;
+                    if (!GetNumaNodeProcessorMask((UCHAR)n, &mask)) continue;
+                    std::vector<int> cpus;
+                    for (int c = 0; c < 64; c++)
+                        if (mask & (1ull << c)) cpus.push_back(c);
+                    if (!cpus.empty()) t.nodes.push_back(cpus);
+                }
+            }
+#endif
+            if (t.nodes.empty()) {
+                t.nodes.emplace_back();
+                for (int c = 0; c < (int)std::max(std::thread::hardware_concurrency(), 1u); c++) t.nodes[0].push_back(c);
+            }
+
+            for (int n = 0; n < (int)t.nodes.size(); n++) {
+                for (auto c : t.nodes[n]) {
+                    if (c >= (int)t.cpuNode.size()) t.cpuNode.resize(c + 1, -1);
+                    t.cpuNode[c] = n;
+                }
+            }
+            return t;
+        }
+
+        // parses lists like "0-7,16-23"
+        static std::vector<int> parseCpuList(const std::string& list) {
+            std::vector<int> cpus;
+            std::stringstream ss(list);
+            std::string range;
+            while (std::getline(ss, range, ',')) {
+                if (range.empty()) continue;
+                const auto dash = range.find('-');
+                try {
+                    const int first = std::stoi(range.substr(0, dash));
+                    const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                    for (int c = first; c <= last; c++) cpus.push_back(c);
+                }
+                catch (const std::exception&) {
+                    // skip malformed ranges
+                }
+            }
+            return cpus;
+        }
+    };
+
+    // false if the thread couldn't be pinned, e.g. when the cpu is outside of the process' affinity
+    inline bool pinThread(std::thread::native_handle_type thread, int cpu) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+        return cpu < 64 && SetThreadAffinityMask((HANDLE)thread, (DWORD_PTR)1 << cpu) != 0;
+#else
+        return false;
+#endif
+    }
+
+    // cpu the calling thread runs on, only stable once the thread is pinned
+    inline int currentCpu() {
+#if defined(__linux__)
+        return sched_getcpu();
+#elif defined(_WIN32)
+        return (int)GetCurrentProcessorNumber();
+#else
+        return 0;
+#endif
+    }
+
+    // leaves the elements it default constructs uninitialized, so the pages of a large vector are only placed
+    // once a thread writes them. T must be trivially destructible and fully written before it's read
+    template<typename T>
+    struct untouched_allocator : std::allocator<T> {
+        template<typename U> struct rebind { using other = untouched_allocator<U>; };
+
+        untouched_allocator() = default;
+        template<typename U> untouched_allocator(const untouched_allocator<U>&) {}
+
+        template<typename U> void construct(U*) {}
+        template<typename U, typename... Args> void construct(U* p, Args&&... args) {
+            ::new((void*)p) U(std::forward<Args>(args)...);
+        }
+    };
+}
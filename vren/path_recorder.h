@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <unordered_map>
+
+#include "tracer_callback.h"
+
+namespace callback {
+    // one per concrete Event class
+    enum class event_kind : uint8_t {
+        New, CandidateHit, HitSkip, MediumSkip, Bounce, Transmitted, MediumHit, SurfaceHit,
+        SpecularScatter, DiffuseScatter, MediumScatter,
+        NoHitTerminal, AbsorbedTerminal, RouletteTerminal, MaxDepthTerminal,
+        PdfSample, Emitted
+    };
+
+    // a recorded event, the meaning of the fields depends on its kind
+    struct path_event {
+        event_kind kind;
+        bool flag = false;  // HitSkip: front face, SpecularScatter: refracted
+        uint32_t id = 0;    // New: sample id, Bounce: depth
+        vec3 a, b;          // New: ray origin and direction, hits: point, scatters: direction and attenuation,
+                            // Bounce: throughput, Transmitted and Emitted: color
+        double x = 0, y = 0; // New: pixel, Transmitted: distance, MediumHit: distance and rec.t, PdfSample: pdf value
+        int hit = -1;       // index in path_recorder::hits
+        int name = -1;      // index in path_recorder::names of the emitter, pdf or skip reason
+    };
+
+    /*
+     Records the paths of a render into flat buffers, so the events are only generated once and can be replayed into
+     as many callbacks as needed, e.g. to draw a pixel's paths and print them from a single DebugPixel().
+     With a region, only the samples of the pixels inside [x0, x1) x [y0, y1) are kept, so it can also be passed to
+     a non parallel Render().
+    */
+    class path_recorder : public callback {
+    private:
+        const int x0, y0, x1, y1;
+        bool recording = false; // current sample is inside the region
+        std::unordered_map<std::string, int> nameIds;
+
+        int addName(const std::string& name) {
+            auto it = nameIds.find(name);
+            if (it != nameIds.end()) return it->second;
+            names.push_back(name);
+            return nameIds[name] = (int)names.size() - 1;
+        }
+
+        // surface hits and scatters report the candidate hit that precedes them, it's only stored once
+        int addHit(const hit_record& rec) {
+            if (!hits.empty()) {
+                const auto& last = hits.back();
+                if (last.obj_ptr == rec.obj_ptr && last.t == rec.t && last.element == rec.element && last.front_face == rec.front_face)
+                    return (int)hits.size() - 1;
+            }
+            hits.push_back(rec);
+            return (int)hits.size() - 1;
+        }
+
+        void add(path_event e) { events.push_back(e); }
+
+    public:
+        std::vector<path_event> events;
+        std::vector<size_t> paths; // index of the first event of each path
+        std::vector<hit_record> hits;
+        std::vector<std::string> names;
+
+        path_recorder(int x0 = 0, int y0 = 0,
+            int x1 = std::numeric_limits<int>::max(), int y1 = std::numeric_limits<int>::max()) :
+            x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+        virtual void operator ()(event_ptr e) override {
+            if (auto n = cast<New>(e)) {
+                recording = (int)n->x >= x0 && (int)n->x < x1 && (int)n->y >= y0 && (int)n->y < y1;
+                if (!recording) return;
+                paths.push_back(events.size());
+                path_event pe{ event_kind::New };
+                pe.id = n->sampleId;
+                pe.a = n->r.origin();
+                pe.b = n->r.direction();
+                pe.x = n->x;
+                pe.y = n->y;
+                add(pe);
+                return;
+            }
+            if (!recording) return;
+
+            path_event pe{};
+            if (auto h = cast<CandidateHit>(e)) {
+                pe.kind = event_kind::CandidateHit;
+                pe.hit = addHit(h->rec);
+            }
+            else if (auto h = cast<HitSkip>(e)) {
+                pe.kind = event_kind::HitSkip;
+                pe.flag = h->front_face;
+            }
+            else if (auto s = cast<MediumSkip>(e)) {
+                pe.kind = event_kind::MediumSkip;
+                pe.name = addName(s->reason);
+            }
+            else if (auto b = cast<Bounce>(e)) {
+                pe.kind = event_kind::Bounce;
+                pe.id = b->depth;
+                pe.a = b->throughput;
+            }
+            else if (auto t = cast<Transmitted>(e)) {
+                pe.kind = event_kind::Transmitted;
+                pe.x = t->distance;
+                pe.a = t->transmission;
+            }
+            else if (auto h = cast<MediumHit>(e)) {
+                pe.kind = event_kind::MediumHit;
+                pe.a = h->p;
+                pe.x = h->distance;
+                pe.y = h->rec_t;
+            }
+            else if (auto h = cast<SurfaceHit>(e)) {
+                pe.kind = event_kind::SurfaceHit;
+                pe.a = h->p;
+                pe.hit = addHit(h->rec);
+            }
+            else if (auto s = cast<SpecularScatter>(e)) {
+                pe.kind = event_kind::SpecularScatter;
+                pe.a = s->d;
+                pe.b = s->srec.attenuation;
+                pe.flag = s->srec.is_refracted;
+                pe.hit = addHit(s->rec);
+            }
+            else if (auto s = cast<DiffuseScatter>(e)) {
+                pe.kind = event_kind::DiffuseScatter;
+                pe.a = s->d;
+                pe.hit = addHit(s->rec);
+            }
+            else if (auto s = cast<MediumScatter>(e)) {
+                pe.kind = event_kind::MediumScatter;
+                pe.a = s->d;
+            }
+            else if (cast<NoHitTerminal>(e)) pe.kind = event_kind::NoHitTerminal;
+            else if (cast<AbsorbedTerminal>(e)) pe.kind = event_kind::AbsorbedTerminal;
+            else if (cast<RouletteTerminal>(e)) pe.kind = event_kind::RouletteTerminal;
+            else if (cast<MaxDepthTerminal>(e)) pe.kind = event_kind::MaxDepthTerminal;
+            else if (auto p = cast<PdfSample>(e)) {
+                pe.kind = event_kind::PdfSample;
+                pe.name = addName(p->pdf_name);
+                pe.x = p->pdf_val;
+            }
+            else if (auto em = cast<Emitted>(e)) {
+                pe.kind = event_kind::Emitted;
+                pe.name = addName(em->emitter);
+                pe.a = em->emitted;
+            }
+            else {
+                return; // not an event the pathtracer generates
+            }
+            add(pe);
+        }
+
+        // rebuilds the event
+        event_ptr toEvent(const path_event& pe) const {
+            switch (pe.kind) {
+            case event_kind::New: return New::make(ray(pe.a, pe.b), (unsigned)pe.x, (unsigned)pe.y, pe.id);
+            case event_kind::CandidateHit: return CandidateHit::make(hits[pe.hit]);
+            case event_kind::HitSkip: return HitSkip::make(pe.flag);
+            case event_kind::MediumSkip: return MediumSkip::make(names[pe.name]);
+            case event_kind::Bounce: return Bounce::make(pe.id, pe.a);
+            case event_kind::Transmitted: return Transmitted::make(pe.x, pe.a);
+            case event_kind::MediumHit: return MediumHit::make(pe.a, pe.x, pe.y);
+            case event_kind::SurfaceHit: return SurfaceHit::make(hits[pe.hit]);
+            case event_kind::SpecularScatter: {
+                scatter_record srec;
+                srec.is_specular = true;
+                srec.is_refracted = pe.flag;
+                srec.attenuation = pe.b;
+                return SpecularScatter::make(pe.a, hits[pe.hit], srec);
+            }
+            case event_kind::DiffuseScatter: return DiffuseScatter::make(pe.a, hits[pe.hit]);
+            case event_kind::MediumScatter: return MediumScatter::make(pe.a);
+            case event_kind::NoHitTerminal: return NoHitTerminal::make();
+            case event_kind::AbsorbedTerminal: return AbsorbedTerminal::make();
+            case event_kind::RouletteTerminal: return RouletteTerminal::make();
+            case event_kind::MaxDepthTerminal: return MaxDepthTerminal::make();
+            case event_kind::PdfSample: return PdfSample::make(names[pe.name], pe.x);
+            case event_kind::Emitted: return Emitted::make(names[pe.name], pe.a);
+            }
+            return nullptr;
+        }
+
+        // feeds the recorded events, in order, to cb. Stops early if cb terminates
+        void replay(callback& cb) const {
+            for (const auto& pe : events) {
+                cb(toEvent(pe));
+                if (cb.terminate()) return;
+            }
+        }
+
+        // feeds the events of the given path, paths are indexed in the order their samples were rendered
+        void replayPath(size_t path, callback& cb) const {
+            const auto end = path + 1 < paths.size() ? paths[path + 1] : events.size();
+            for (auto i = paths[path]; i < end; i++) cb(toEvent(events[i]));
+        }
+
+        size_t numPaths() const { return paths.size(); }
+
+        void clear() {
+            events.clear();
+            paths.clear();
+            hits.clear();
+            names.clear();
+            nameIds.clear();
+        }
+    };
+}
@@ -7,8 +7,16 @@
 #include "thread_pool.hpp"
 #include "envmap.h"
 #include "Film.h"
+#include "profiler.h"
+#include "ray_sort.h"
+#include "numa.h"
 
 #include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <typeindex>
 
 
 struct scene_desc {
@@ -29,205 +37,377 @@ private:
     const unsigned max_depth;
     const unsigned rroulette_depth;
 
-    std::vector<unsigned> seeds;
+    std::vector<unsigned, numa::untouched_allocator<unsigned>> seeds;
     thread_pool pool;
 
     Film& film;
 
-    color ray_color(const ray& r, rnd& rng, callback::callback* cb) {
-        const double epsilon = 0.001;
+    // lines [lineBands[n], lineBands[n + 1]) are rendered by the threads of NUMA node n first, see PinThreads()
+    std::vector<int> lineBands;
+    numa::topology topology;
+
+    // pass running in the background, see RenderAsync()
+    std::shared_ptr<render_job> job;
+    // renders the passes of RenderAsync() one after the other, it's started by the first one and lives as long as
+    // the pathtracer, so interactive passes don't pay for a thread each
+    std::thread dispatcher;
+    std::mutex dispatchMutex;
+    std::condition_variable dispatchCv;
+    std::function<void()> pendingPass; // empty once the dispatcher took it
+    bool quitDispatcher = false;
+    static constexpr int tileSize = 64;
+
+    // sorts secondary rays by coherence before intersecting them, see RenderLineBatched()
+    bool sortRays = false;
+    // evaluates mediums and materials with their batched kernels, see ShadeBatched()
+    bool batchShading = true;
+    // passes render one sample per previewSize x previewSize block, see RenderPreviewTile()
+    int previewSize = 1;
+    // film pixels rendered first and with more samples by RenderAsync(), see SetFocus()
+    int focusX0 = 0, focusY0 = 0, focusX1 = 0, focusY1 = 0;
+    unsigned focusBoost = 1;
+    // camera moves reproject the film instead of resetting it, see ReprojectFilm()
+    bool reproject = false;
+    static constexpr float maxHistory = 64.0f;    // carried samples count for at most that many new ones
+    static constexpr float historyDecay = 0.75f;  // weight kept by the carried samples at each move
+    static constexpr float depthTolerance = 0.1f;
+
+    mutable std::mutex statsMutex;
+    render_stats stats;
+
+    // each render thread counts into its own stats, they are merged once the thread is done
+    static render_stats& localStats() {
+        static thread_local render_stats local;
+        return local;
+    }
+
+    void ResetLocalStats() {
+        localStats() = {};
+#ifdef VREN_BVH_STATS
+        thread_traversal_stats() = {};
+#endif
+    }
+
+    void MergeLocalStats(double busySeconds) {
+        localStats().busy_seconds = busySeconds;
+#ifdef VREN_BVH_STATS
+        localStats().traversal = thread_traversal_stats();
+#endif
+        const std::lock_guard<std::mutex> lock(statsMutex);
+        stats += localStats();
+    }
+
+    static constexpr double epsilon = 0.001;
 
-        color throughput = { 1, 1, 1 };
-        color emitted = { 0, 0, 0 };
-        ray curRay = r;
+    // camera ray of a pixel sample, (dx, dy) is its offset inside the pixel
+    struct pixel_sample {
+        double dx, dy;
+        ray r;
+    };
 
+    // state of a path between two bounces
+    struct path_state {
+        ray r; // next ray to intersect
+        color throughput{ 1, 1, 1 };
+        color emitted{ 0, 0, 0 };
         Medium* medium = nullptr;
         hittable* medium_obj = nullptr;
+        unsigned depth = 0;
+
+        path_state() {}
+        path_state(const ray& r) : r(r) {}
+    };
+
+    // a bounce is shaded in steps, so the batched renderer can sample the mediums and scatter the materials
+    // of many paths at once in between. Each step tells which one comes next
+    enum class bounce_step { SampleMedium, Scatter, Roulette, Next, Terminated };
+
+    // accounts for the intersection of s.r with the scene, hit is false when it missed
+    // when aov is set, it receives the values of the first hit
+    bounce_step BeginBounce(path_state& s, bool hit, const hit_record& rec, callback::callback* cb, aov_sample* aov) {
+        if (!hit) {
+            color e = scene.background;
+            if (scene.envmap) {
+                PROFILE_STAGE(profiler::Envmap, s.depth);
+                e = scene.envmap->value(s.r.direction());
+            }
+            s.emitted += s.throughput * e;
+            if (cb && max(e) > 0.0)
+                (*cb)(callback::Emitted::make(scene.envmap ? "env_light" : "background", e));
 
-        for (auto depth = 0; depth < max_depth; ++depth) {
-            if (cb && cb->terminate()) break;
-            if (cb) (*cb)(callback::Bounce::make(depth, throughput));
+            if (aov && s.depth == 0) {
+                auto a = toYocto(e);
+                aov->albedo = { std::min(a.x, 1.0f), std::min(a.y, 1.0f), std::min(a.z, 1.0f) };
+            }
 
-            hit_record rec;
-            if (!scene.world.hit(curRay, epsilon, infinity, rec)) {
-                if (scene.envmap) {
-                    color e = scene.envmap->value(curRay.direction());
-                    emitted += throughput * e;
-                    if (cb && max(e) > 0.0)
-                        (*cb)(callback::Emitted::make("env_light", e));
-                }
-                else {
-                    emitted += throughput * scene.background;
-                    if (cb && max(scene.background) > 0.0)
-                        (*cb)(callback::Emitted::make("background", scene.background));
-                }
+            if (cb) (*cb)(callback::NoHitTerminal::make());
 
-                if (cb) (*cb)(callback::NoHitTerminal::make());
+            return bounce_step::Terminated;
+        }
 
-                return emitted;
-            }
+        if (cb) (*cb)(callback::CandidateHit::make(rec));
 
-            if (cb) (*cb)(callback::CandidateHit::make(rec));
+        if (aov && s.depth == 0) {
+            aov->normal = toYocto(rec.normal);
+            aov->depth = (float)rec.t;
+            aov->hits = 1;
+            aov->object = rec.obj_ptr->id;
+            aov->element = rec.element;
+        }
 
-            bool hitSurface = true;
-            if (medium && rec.obj_ptr == medium_obj && rec.front_face) {
-                // once ray enters a medium it can't hit the front surface of the same medium
-                // when this happens we assume the ray exited the medium in the previous bounce
-                // we still allow other objects to be inside the medium but we don't yet support
-                // overlapping mediums
-                medium = nullptr;
-                medium_obj = nullptr;
-                if (cb) (*cb)(callback::MediumSkip::make("internal face"));
-            }
+        if (s.medium && rec.obj_ptr == s.medium_obj && rec.front_face) {
+            // once ray enters a medium it can't hit the front surface of the same medium
+            // when this happens we assume the ray exited the medium in the previous bounce
+            // we still allow other objects to be inside the medium but we don't yet support
+            // overlapping mediums
+            s.medium = nullptr;
+            s.medium_obj = nullptr;
+            if (cb) (*cb)(callback::MediumSkip::make("internal face"));
+        }
 
-            // take current medium into account
-            if (medium) {
-                // check if there is an internal scattering
-                double distance;
-                color transmission = medium->SampleDistance(rec.t, distance, rng);
-                throughput *= transmission;
+        // take current medium into account
+        if (s.medium) return bounce_step::SampleMedium;
 
-                if (cb) (*cb)(callback::Transmitted::make(distance, transmission));
+        return HitSurface(s, rec, cb);
+    }
 
-                if ((distance + epsilon) < rec.t) {
-                    vec3 sampled;
-                    medium->SampleDirection(curRay.direction(), sampled, rng);
-                    ray scattered = ray(curRay.at(distance), sampled);
+    // continues the bounce once s.medium sampled the scattering distance and transmission along the ray
+    bounce_step MediumBounce(path_state& s, const hit_record& rec, double distance, const color& transmission,
+            rnd& rng, callback::callback* cb) {
+        s.throughput *= transmission;
+        if (cb) (*cb)(callback::Transmitted::make(distance, transmission));
+
+        if ((distance + epsilon) < rec.t) {
+            ray scattered;
+            {
+                PROFILE_STAGE(profiler::Medium, s.depth);
+                vec3 sampled;
+                s.medium->SampleDirection(s.r.direction(), sampled, rng);
+                scattered = ray(s.r.at(distance), sampled);
+            }
 
-                    // if the scattered ray is too close to the surface it is possible
-                    // it will miss it, in that case ignore the medium scattering
-                    hit_record tmp;
-                    if (medium_obj->hit(scattered, epsilon, infinity, tmp)) {
-                        // ray scattered inside the medium
-                        hitSurface = false;
-                        curRay = scattered;
+            // if the scattered ray is too close to the surface it is possible
+            // it will miss it, in that case ignore the medium scattering
+            // this is a scene query, it's timed with the other intersections and not as part of the medium
+            bool inside;
+            ++localStats().rays;
+            {
+                PROFILE_STAGE(profiler::Intersect, s.depth);
+                inside = s.medium_obj->occluded(scattered, epsilon, infinity);
+            }
+            if (inside) {
+                // ray scattered inside the medium
+                s.r = scattered;
 
-                        if (cb) {
-                            (*cb)(callback::MediumHit::make(scattered.origin(), distance, rec.t));
-                            (*cb)(callback::MediumScatter::make(scattered.direction()));
-                        }
-                    }
-                    else {
-                        if (cb) (*cb)(callback::MediumSkip::make("scattered ray misses medium_obj"));
-                    }
-                }
-                else {
-                    // we are ignoring the medium scatter and treating this as a surface hit instead
-                    if (cb) (*cb)(callback::MediumSkip::make("scatter beyond surface"));
+                if (cb) {
+                    (*cb)(callback::MediumHit::make(scattered.origin(), distance, rec.t));
+                    (*cb)(callback::MediumScatter::make(scattered.direction()));
                 }
+                return bounce_step::Roulette;
             }
+            else {
+                if (cb) (*cb)(callback::MediumSkip::make("scattered ray misses medium_obj"));
+            }
+        }
+        else {
+            // we are ignoring the medium scatter and treating this as a surface hit instead
+            if (cb) (*cb)(callback::MediumSkip::make("scatter beyond surface"));
+        }
 
-            if (hitSurface) {
-                if (!medium && !rec.front_face) {
-                    // back hits only allowed inside mediums
-                    // otherwise we assume it's a precision issue and we ignore the hit
-                    if (cb) (*cb)(callback::HitSkip::make(rec.front_face));
-                    curRay = { rec.p, curRay.direction() };
-                    continue;
-                }
+        return HitSurface(s, rec, cb);
+    }
 
-                // only account for hit, when we actually hit the surface
-                if (cb) (*cb)(callback::SurfaceHit::make(rec));
+    bounce_step HitSurface(path_state& s, const hit_record& rec, callback::callback* cb) {
+        if (!s.medium && !rec.front_face) {
+            // back hits only allowed inside mediums
+            // otherwise we assume it's a precision issue and we ignore the hit
+            if (cb) (*cb)(callback::HitSkip::make(rec.front_face));
+            s.r = { rec.p, s.r.direction() };
+            ++s.depth;
+            return bounce_step::Next;
+        }
 
-                scatter_record srec;
-                color e = rec.mat_ptr->emitted(curRay, rec, rec.u, rec.v, rec.p);
-                if (cb && max(e) > 0.0)
-                    (*cb)(callback::Emitted::make(rec.obj_ptr->name, e));
+        // only account for hit, when we actually hit the surface
+        if (cb) (*cb)(callback::SurfaceHit::make(rec));
 
-                emitted += e * throughput;
+        return bounce_step::Scatter;
+    }
 
-                if (!rec.mat_ptr->scatter(curRay, rec, srec, rng)) {
-                    if (cb) (*cb)(callback::AbsorbedTerminal::make());
-                    return emitted;
-                }
+    // continues the bounce once rec.mat_ptr scattered the ray into srec
+    bounce_step ScatterBounce(path_state& s, const hit_record& rec, scatter_record& srec, bool scatters,
+            rnd& rng, callback::callback* cb, aov_sample* aov) {
+        color e;
+        {
+            PROFILE_STAGE(profiler::Scatter, s.depth);
+            e = rec.mat_ptr->emitted(s.r, rec, rec.u, rec.v, rec.p);
+        }
+        if (cb && max(e) > 0.0)
+            (*cb)(callback::Emitted::make(rec.obj_ptr->name, e));
 
-                if (medium && srec.is_specular && !srec.is_refracted) {
-                    // even though reflected rays should remain inside the medium
-                    // it is possible for the ray to miss the next intersection with the surface
-                    // the sample color will still be computed correctly but this will cause our
-                    // validation_callback to detect this as a bug
-                    // to avoid that, we check that we can hit the medium_obj in a back face
-                    // or change the scattered ray to refracted
-                    hit_record trec;
-                    if (!medium_obj->hit(srec.specular_ray, epsilon, infinity, trec) || trec.front_face) {
-                        srec.is_refracted = true; // this will make the ray exit the medium
-                        if (cb) (*cb)(callback::MediumSkip::make("swap reflected to refracted"));
-                    }
-                }
+        s.emitted += e * s.throughput;
 
-                // check if we entered or exited a medium
-                // we assume that mediums can't overlap
-                if (srec.is_refracted) {
-                    if (medium) {
-                        // we are exiting the medium
-                        medium = nullptr;
-                        medium_obj = nullptr;
-                        //TODO report event
-                    }
-                    else {
-                        // we are entering the medium
-                        medium = srec.medium_ptr;
-                        medium_obj = rec.obj_ptr;
-                        //TODO if medium null report a WARN event
-                    }
-                }
+        if (!scatters) {
+            if (cb) (*cb)(callback::AbsorbedTerminal::make());
+            return bounce_step::Terminated;
+        }
 
-                if (srec.is_specular) {
-                    throughput *= srec.attenuation;
-                    curRay = srec.specular_ray;
+        if (aov && s.depth == 0) aov->albedo = toYocto(srec.attenuation);
+
+        if (s.medium && srec.is_specular && !srec.is_refracted) {
+            // even though reflected rays should remain inside the medium
+            // it is possible for the ray to miss the next intersection with the surface
+            // the sample color will still be computed correctly but this will cause our
+            // validation_callback to detect this as a bug
+            // to avoid that, we check that we can hit the medium_obj in a back face
+            // or change the scattered ray to refracted
+            hit_record trec;
+            ++localStats().rays;
+            if (!s.medium_obj->hit(srec.specular_ray, epsilon, infinity, trec) || trec.front_face) {
+                srec.is_refracted = true; // this will make the ray exit the medium
+                if (cb) (*cb)(callback::MediumSkip::make("swap reflected to refracted"));
+            }
+        }
 
-                    if (cb) (*cb)(callback::SpecularScatter::make(curRay.direction(), rec, srec));
+        // check if we entered or exited a medium
+        // we assume that mediums can't overlap
+        if (srec.is_refracted) {
+            if (s.medium) {
+                // we are exiting the medium
+                s.medium = nullptr;
+                s.medium_obj = nullptr;
+                //TODO report event
+            }
+            else {
+                // we are entering the medium
+                s.medium = srec.medium_ptr;
+                s.medium_obj = rec.obj_ptr;
+                //TODO if medium null report a WARN event
+            }
+        }
 
-                    continue;
-                }
+        if (srec.is_specular) {
+            s.throughput *= srec.attenuation;
+            s.r = srec.specular_ray;
 
-                pdf* mat_pdf = srec.pdf_ptr.get();
-                bool using_mixture = false;
-                {
-                    pdf* light_pdf = scene.getSceneLightPdf(rec.p);
-                    if (light_pdf) {
-                        mat_pdf = new mixture_pdf(light_pdf, mat_pdf);
-                        using_mixture = true;
-                    }
+            if (cb) (*cb)(callback::SpecularScatter::make(s.r.direction(), rec, srec));
+
+            ++s.depth;
+            return bounce_step::Next;
+        }
+
+        ray scattered;
+        double pdf_val;
+        double scattering_pdf;
+        {
+            PROFILE_STAGE(profiler::Pdf, s.depth);
+            pdf* mat_pdf = srec.pdf_ptr.get();
+            bool using_mixture = false;
+            {
+                pdf* light_pdf = scene.getSceneLightPdf(rec.p);
+                if (light_pdf) {
+                    mat_pdf = new mixture_pdf(light_pdf, mat_pdf);
+                    using_mixture = true;
                 }
+            }
 
-                ray scattered = ray(rec.p, mat_pdf->generate(rng));
-                double pdf_val = mat_pdf->value(scattered.direction());
-                if (cb)(*cb)(callback::PdfSample::make(mat_pdf->name(), pdf_val));
+            scattered = ray(rec.p, mat_pdf->generate(rng));
+            pdf_val = mat_pdf->value(scattered.direction());
+            if (cb)(*cb)(callback::PdfSample::make(mat_pdf->name(), pdf_val));
 
-                if (using_mixture)
-                    delete mat_pdf;
+            if (using_mixture)
+                delete mat_pdf;
 
-                double scattering_pdf = rec.mat_ptr->scattering_pdf(curRay, rec, scattered);
-                // when sampling lights it is possible to generate scattered rays that go inside the surface
-                // those will be absorbed by the surface
-                if (scattering_pdf <= 0.0) {
-                    if (cb) (*cb)(callback::AbsorbedTerminal::make());
-                    return emitted;
-                }
+            scattering_pdf = rec.mat_ptr->scattering_pdf(s.r, rec, scattered);
+        }
+        // when sampling lights it is possible to generate scattered rays that go inside the surface
+        // those will be absorbed by the surface
+        if (scattering_pdf <= 0.0) {
+            if (cb) (*cb)(callback::AbsorbedTerminal::make());
+            return bounce_step::Terminated;
+        }
+
+        s.throughput *= srec.attenuation * scattering_pdf / pdf_val;
 
-                throughput *= srec.attenuation * scattering_pdf / pdf_val;
+        if (cb) (*cb)(callback::DiffuseScatter::make(scattered.direction(), rec));
 
-                if (cb) (*cb)(callback::DiffuseScatter::make(scattered.direction(), rec));
+        s.r = scattered;
+        return bounce_step::Roulette;
+    }
 
-                curRay = scattered;
+    // Russian roulette, ends the bounce
+    bounce_step Roulette(path_state& s, rnd& rng, callback::callback* cb) {
+        if (s.depth > rroulette_depth) {
+            double m = max(s.throughput);
+            double roll;
+            {
+                PROFILE_STAGE(profiler::Rng, s.depth);
+                roll = rng.random_double();
             }
+            if (roll > m) {
+                if (cb) (*cb)(callback::RouletteTerminal::make());
 
-            // Russian roulette
-            if (depth > rroulette_depth) {
-                double m = max(throughput);
-                if (rng.random_double() > m) {
-                    if (cb) (*cb)(callback::RouletteTerminal::make());
+                return bounce_step::Terminated;
+            }
+            s.throughput *= 1 / m;
+        }
 
-                    return emitted;
-                }
-                throughput *= 1 / m;
+        ++s.depth;
+        return bounce_step::Next;
+    }
+
+    // one bounce of the path, runs its steps one after the other
+    // returns false once the path is terminated, otherwise s.r is set to the next ray and s.depth is incremented
+    bool ShadeHit(path_state& s, bool hit, const hit_record& rec, rnd& rng, callback::callback* cb, aov_sample* aov) {
+        bounce_step step = BeginBounce(s, hit, rec, cb, aov);
+
+        if (step == bounce_step::SampleMedium) {
+            double distance;
+            color transmission;
+            {
+                PROFILE_STAGE(profiler::Medium, s.depth);
+                transmission = s.medium->SampleDistance(rec.t, distance, rng);
+            }
+            step = MediumBounce(s, rec, distance, transmission, rng, cb);
+        }
+
+        if (step == bounce_step::Scatter) {
+            scatter_record srec;
+            bool scatters;
+            {
+                PROFILE_STAGE(profiler::Scatter, s.depth);
+                scatters = rec.mat_ptr->scatter(s.r, rec, srec, rng);
             }
+            step = ScatterBounce(s, rec, srec, scatters, rng, cb, aov);
+        }
+
+        if (step == bounce_step::Roulette) step = Roulette(s, rng, cb);
+
+        return step == bounce_step::Next;
+    }
+
+    // when aov is set, it receives the values of the first hit
+    color ray_color(const ray& r, rnd& rng, callback::callback* cb, aov_sample* aov = nullptr) {
+        path_state s(r);
+
+        while (s.depth < max_depth) {
+            if (cb && cb->terminate()) break;
+            if (cb) (*cb)(callback::Bounce::make(s.depth, s.throughput));
+
+            hit_record rec;
+            bool hit;
+            {
+                ++localStats().rays;
+                ++localStats().bounces;
+                PROFILE_STAGE(profiler::Intersect, s.depth);
+                hit = scene.world.hit(s.r, epsilon, infinity, rec);
+            }
+            if (!ShadeHit(s, hit, rec, rng, cb, aov))
+                return s.emitted;
         }
 
         // if we reach this point, we've exceeded the ray bounce limit, no more lights gathered
         if (cb) (*cb)(callback::MaxDepthTerminal::make());
-        return emitted;
+        return s.emitted;
 
     }
 
@@ -247,30 +427,287 @@ private:
         }
     }
 
+    pixel_sample GenerateSample(unsigned i, unsigned j, rnd& rng) const {
+        pixel_sample ps;
+        {
+            PROFILE_STAGE(profiler::Rng, 0);
+            ps.dx = rng.random_double();
+            ps.dy = rng.random_double();
+        }
+        auto u = (i + ps.dx) / (film.width - 1);
+        auto v = (j + ps.dy) / (film.height - 1);
+        ps.r = cam.get_ray(u, v, rng);
+        return ps;
+    }
+
+    // traces the sample's path, aov receives its first hit values when write_aovs is set
+    // when tile is set, the sample is also splatted into it through the film's filter
+    color TraceSample(const pixel_sample& ps, unsigned i, unsigned j, rnd& rng, callback::callback* cb,
+            aov_sample& aov, bool write_aovs, FilmTile* tile) {
+        ++localStats().paths;
+#ifdef VREN_BVH_STATS
+        const traversal_stats before = thread_traversal_stats();
+#endif
+        const color sample_color = ray_color(ps.r, rng, cb, write_aovs ? &aov : nullptr);
+#ifdef VREN_BVH_STATS
+        // cost of the whole path, not just its first hit
+        aov.nodes = (float)(thread_traversal_stats().nodes - before.nodes);
+        aov.triangles = (float)(thread_traversal_stats().triangles - before.triangles);
+#endif
+        if (tile) tile->AddSplat(i + ps.dx, film.height - (j + ps.dy), toYocto(sample_color));
+        return sample_color;
+    }
+
     color RenderPixel(unsigned i, unsigned j, unsigned spp, callback::callback* cb, bool force_reset_seed = false) {
         color pixel_color{ 0, 0, 0 };
 
         unsigned seed = force_reset_seed ? computeSeed(i, j) : seeds[pixelIdx(i, j)];
         xor_rnd local_rng{ seed };
 
+        // debug renders don't contribute to the film's aovs
+        const bool write_aovs = !force_reset_seed && film.HasAOVs();
+        aov_sample aov_sum{};
+        unsigned num_samples = 0;
+
         for (auto s = 0; s != spp; ++s) {
-            auto u = (i + local_rng.random_double()) / (film.width - 1);
-            auto v = (j + local_rng.random_double()) / (film.height - 1);
-            ray r = cam.get_ray(u, v, local_rng);
+            // generating the sample is part of the path, so its rng time is a share of the path time
+            PROFILE_STAGE(profiler::Path, 0);
+            const pixel_sample ps = GenerateSample(i, j, local_rng);
 
-            if (cb) (*cb)(callback::New::make(r, i, (film.height - 1) - j, s));
+            if (cb) (*cb)(callback::New::make(ps.r, i, (film.height - 1) - j, s));
 
-            pixel_color += ray_color(r, local_rng, cb);
+            aov_sample aov{};
+            pixel_color += TraceSample(ps, i, j, local_rng, cb, aov, write_aovs, nullptr);
+            aov_sum.add(aov);
+            ++num_samples;
             if (cb && cb->terminate()) break;
         }
 
         if (!force_reset_seed)
             seeds[pixelIdx(i, j)] = local_rng.getState();
 
+        if (write_aovs)
+            film.AddAOVs(i, (film.height - 1) - j, aov_sum, num_samples);
+
         return pixel_color;
     }
 
+    // orders paths by the type and then the instance of the material they hit, misses are grouped together
+    // shading a material's hits together keeps its code and data hot and its branches predictable
+    static void GroupByMaterial(std::vector<int>& paths, const std::vector<hit_record>& recs,
+            const std::vector<uint8_t>& hits) {
+        std::vector<std::pair<std::pair<std::type_index, const material*>, int>> keys;
+        keys.reserve(paths.size());
+        for (auto k : paths) {
+            const material* mat = hits[k] ? recs[k].mat_ptr : nullptr;
+            keys.push_back({ { mat ? std::type_index(typeid(*mat)) : std::type_index(typeid(void)), mat }, k });
+        }
+        std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (auto i = 0; i < keys.size(); ++i) paths[i] = keys[i].second;
+    }
+
+    // scratch space of ShadeBatched(), reused between bounces
+    struct shading_queues {
+        std::vector<bounce_step> steps; // indexed by path
+        std::vector<int> queue;
+        distance_batch distances;
+        scatter_batch scatters;
+    };
+
+    // same as calling ShadeHit() on the active paths, but paths inside the same medium sample their distance
+    // in a single batch, and hits of the same material are scattered in a single batch
+    // active must be grouped by material, queues.steps receives the last step of every active path
+    void ShadeBatched(const std::vector<int>& active, std::vector<path_state>& paths,
+            const std::vector<hit_record>& recs, const std::vector<uint8_t>& hits, std::vector<xor_rnd>& rngs,
+            std::vector<aov_sample>* aovs, shading_queues& queues) {
+        auto& steps = queues.steps;
+        auto& queue = queues.queue;
+
+        for (auto k : active)
+            steps[k] = BeginBounce(paths[k], hits[k] != 0, recs[k], nullptr, aovs ? &(*aovs)[k] : nullptr);
+
+        // calls batch(begin, end) on every run of consecutive paths of queue that have the same key
+        auto forEachRun = [&](auto key, auto batch) {
+            for (size_t begin = 0; begin < queue.size();) {
+                size_t end = begin + 1;
+                while (end < queue.size() && key(queue[end]) == key(queue[begin])) ++end;
+                batch(begin, end);
+                begin = end;
+            }
+        };
+
+        queue.clear();
+        for (auto k : active) if (steps[k] == bounce_step::SampleMedium) queue.push_back(k);
+        std::stable_sort(queue.begin(), queue.end(),
+            [&](int a, int b) { return std::less<const Medium*>()(paths[a].medium, paths[b].medium); });
+        forEachRun([&](int k) { return paths[k].medium; }, [&](size_t begin, size_t end) {
+            auto& b = queues.distances;
+            b.resize(end - begin);
+            for (auto i = begin; i < end; ++i) {
+                b.tMax[i - begin] = recs[queue[i]].t;
+                b.rngs[i - begin] = &rngs[queue[i]];
+            }
+            const auto depth = paths[queue[begin]].depth;
+            {
+                PROFILE_STAGE(profiler::Medium, depth);
+                paths[queue[begin]].medium->SampleDistance(b);
+            }
+            for (auto i = begin; i < end; ++i) {
+                const int k = queue[i];
+                steps[k] = MediumBounce(paths[k], recs[k], b.distance[i - begin], b.transmission(i - begin), rngs[k], nullptr);
+            }
+            });
+
+        // active is grouped by material already
+        queue.clear();
+        for (auto k : active) if (steps[k] == bounce_step::Scatter) queue.push_back(k);
+        forEachRun([&](int k) { return recs[k].mat_ptr; }, [&](size_t begin, size_t end) {
+            auto& b = queues.scatters;
+            b.resize(end - begin);
+            for (auto i = begin; i < end; ++i) b.set(i - begin, paths[queue[i]].r, recs[queue[i]], rngs[queue[i]]);
+            const auto depth = paths[queue[begin]].depth;
+            {
+                PROFILE_STAGE(profiler::Scatter, depth);
+                recs[queue[begin]].mat_ptr->scatter(b);
+            }
+            for (auto i = begin; i < end; ++i) {
+                const int k = queue[i];
+                steps[k] = ScatterBounce(paths[k], recs[k], b.srecs[i - begin], b.scatters[i - begin] != 0, rngs[k],
+                    nullptr, aovs ? &(*aovs)[k] : nullptr);
+            }
+            });
+
+        for (auto k : active) if (steps[k] == bounce_step::Roulette) steps[k] = Roulette(paths[k], rngs[k], nullptr);
+    }
+
+    // same as calling RenderPixel() on every pixel of the line, but the paths of each sample index are traced
+    // together one bounce at a time, so every bounce is intersected as a single batch
+    // every pixel keeps its own rng so the image doesn't change
+    void RenderLineBatched(unsigned j, unsigned startX, unsigned endX, unsigned spp, FilmTile* tile) {
+        const unsigned count = endX - startX;
+        const bool write_aovs = film.HasAOVs();
+
+        std::vector<xor_rnd> rngs;
+        rngs.reserve(count);
+        for (auto i = startX; i < endX; ++i) rngs.emplace_back(seeds[pixelIdx(i, j)]);
+
+        std::vector<color> colors(count, color{ 0, 0, 0 });
+        std::vector<aov_sample> aov_sums(count);
+        std::vector<pixel_sample> samples(count);
+        std::vector<path_state> paths(count);
+        std::vector<aov_sample> aovs(count);
+        std::vector<hit_record> recs(count);
+        std::vector<uint8_t> hits(count);
+        std::vector<int> active, next;
+        shading_queues queues;
+        queues.steps.resize(count);
+        active.reserve(count);
+        next.reserve(count);
+        ray_batch batch(count);
+
+        for (auto s = 0; s != spp; ++s) {
+            // same as RenderPixel(), the sample generation is part of the path
+            PROFILE_STAGE(profiler::Path, 0);
+            active.clear();
+            for (auto k = 0; k < count; ++k) {
+                samples[k] = GenerateSample(startX + k, j, rngs[k]);
+                paths[k] = path_state(samples[k].r);
+                aovs[k] = {};
+                active.push_back(k);
+            }
+            localStats().paths += count;
+
+            // all active paths are at the same depth
+            for (auto depth = 0; depth < max_depth && !active.empty(); ++depth) {
+                if (sortRays && depth > 0) {
+                    PROFILE_STAGE(profiler::Sort, depth);
+                    sortByCoherence(active,
+                        [&](int k) { return paths[k].r.origin(); },
+                        [&](int k) { return paths[k].r.direction(); });
+                }
+
+                batch.resize(active.size());
+                for (auto a = 0; a < active.size(); ++a) batch.set(a, paths[active[a]].r, epsilon, infinity);
+
+                localStats().rays += active.size();
+                localStats().bounces += active.size();
+#ifdef VREN_BVH_STATS
+                const traversal_stats before = thread_traversal_stats();
+#endif
+                {
+                    PROFILE_STAGE(profiler::Intersect, depth);
+                    scene.world.intersect_batch(batch);
+                }
+#ifdef VREN_BVH_STATS
+                // packets share their node visits, so the cost of the batch is split evenly between its rays
+                const float nodes = (float)(thread_traversal_stats().nodes - before.nodes) / active.size();
+                const float triangles = (float)(thread_traversal_stats().triangles - before.triangles) / active.size();
+#endif
+
+                for (auto a = 0; a < active.size(); ++a) {
+                    const int k = active[a];
+                    hits[k] = batch.found[a];
+                    if (hits[k]) scene.world.resolve(paths[k].r, batch.hits[a], recs[k]);
+#ifdef VREN_BVH_STATS
+                    aovs[k].nodes += nodes;
+                    aovs[k].triangles += triangles;
+#endif
+                }
+
+                // shading queues: hits of the same material are shaded one after the other
+                {
+                    PROFILE_STAGE(profiler::Sort, depth);
+                    GroupByMaterial(active, recs, hits);
+                }
+
+                next.clear();
+                if (batchShading) {
+                    ShadeBatched(active, paths, recs, hits, rngs, write_aovs ? &aovs : nullptr, queues);
+                    for (auto k : active) if (queues.steps[k] == bounce_step::Next) next.push_back(k);
+                }
+                else {
+                    for (auto k : active) {
+                        if (ShadeHit(paths[k], hits[k] != 0, recs[k], rngs[k], nullptr, write_aovs ? &aovs[k] : nullptr))
+                            next.push_back(k);
+                    }
+                }
+                std::swap(active, next);
+            }
+
+            for (auto k = 0; k < count; ++k) {
+                const color& c = paths[k].emitted;
+                if (tile) tile->AddSplat(startX + k + samples[k].dx, film.height - (j + samples[k].dy), toYocto(c));
+                colors[k] += c;
+                aov_sums[k].add(aovs[k]);
+            }
+        }
+
+        const int y = (film.height - 1) - j;
+        for (auto k = 0; k < count; ++k) {
+            const auto i = startX + k;
+            seeds[pixelIdx(i, j)] = rngs[k].getState();
+            if (write_aovs) film.AddAOVs(i, y, aov_sums[k], spp);
+            if (!tile) film.AddSample(i, y, toYocto(colors[k]), spp);
+        }
+    }
+
     void RenderLine(unsigned j, unsigned startX, unsigned endX, unsigned spp, callback::callback* cb) {
+        PROFILE_EVENT("line");
+        if (!cb) {
+            if (film.filter.isPixelBox()) {
+                RenderLineBatched(j, startX, endX, spp, nullptr);
+                return;
+            }
+
+            // samples reach neighboring lines, so accumulate them in a line local tile
+            // and merge it once instead of synchronizing every splat with other threads
+            const int y = (film.height - 1) - j;
+            FilmTile tile = film.GetTile(startX, y, endX, y + 1);
+            RenderLineBatched(j, startX, endX, spp, &tile);
+            film.MergeTile(tile);
+            return;
+        }
+
         for (auto i = startX; i < endX; ++i) {
             const unsigned idx = i + j * film.width;
 
@@ -282,36 +719,268 @@ private:
         }
     }
 
+    std::vector<render_tile> MakeTiles() const {
+        std::vector<render_tile> tiles;
+        for (int j = 0; j < (int)film.height; j += tileSize) {
+            for (int x = 0; x < (int)film.width; x += tileSize) {
+                tiles.push_back({ x, j,
+                    std::min(x + tileSize, (int)film.width), std::min(j + tileSize, (int)film.height) });
+            }
+        }
+        if (focusX0 >= focusX1 || focusY0 >= focusY1) return tiles;
+
+        // the focus in lines, which go up while film rows go down
+        const int j0 = (int)film.height - focusY1;
+        const int j1 = (int)film.height - focusY0;
+        // tiles are ordered by their distance to the focus, the ones that overlap it come first and get boosted
+        auto distance = [&](const render_tile& t) {
+            const int dx = std::max({ focusX0 - t.x1, t.x0 - focusX1, -1 });
+            const int dj = std::max({ j0 - t.j1, t.j0 - j1, -1 });
+            return std::max(dx, dj);
+        };
+        for (auto& t : tiles) if (distance(t) < 0) t.boost = focusBoost;
+        std::stable_sort(tiles.begin(), tiles.end(), [&](const render_tile& a, const render_tile& b) {
+            return distance(a) < distance(b);
+            });
+        return tiles;
+    }
+
+    // blocks are aligned on the film, a tile renders the blocks whose first pixel it contains
+    // the sample is taken at the center of the block and fills all its pixels
+    void RenderPreviewTile(const render_tile& tile, unsigned spp, callback::callback* cb) {
+        const int size = previewSize;
+        auto firstBlock = [size](int p) { return (p + size - 1) / size * size; };
+        for (auto bj = firstBlock(tile.j0); bj < tile.j1; bj += size) {
+            for (auto bi = firstBlock(tile.x0); bi < tile.x1; bi += size) {
+                const int i = std::min(bi + size / 2, (int)film.width - 1);
+                const int j = std::min(bj + size / 2, (int)film.height - 1);
+                color clr = RenderPixel(i, j, spp, cb);
+                if (cb) cb->alterPixelColor(clr);
+                // lines go up, film rows go down
+                film.AddBlock(bi, (int)film.height - bj - size, bi + size, (int)film.height - bj, toYocto(clr), spp);
+                if (cb && cb->terminate()) return;
+            }
+        }
+    }
+
+    void RenderTiles(render_job& job, unsigned spp, bool parallel, callback::callback* cb) {
+        PROFILE_EVENT("pass");
+        auto renderTiles = [&] {
+            render_tile tile;
+            while (job.NextTile(tile)) {
+                ResetLocalStats();
+                wall_timer busy;
+                if (previewSize > 1)
+                    RenderPreviewTile(tile, spp, cb);
+                else
+                    for (auto j = tile.j0; j < tile.j1; j++) RenderLine(j, tile.x0, tile.x1, spp * tile.boost, cb);
+                // preview blocks that start in the tile reach up to previewSize - 1 pixels past it
+                const int reach = previewSize - 1;
+                film.MarkDirty(tile.x0, (int)film.height - tile.j1 - reach, tile.x1 + reach, (int)film.height - tile.j0);
+                // merged after each tile, so GetStats() follows the pass while it runs
+                MergeLocalStats(busy.elapsed_seconds());
+                job.TileDone();
+            }
+        };
+
+        if (parallel) pool.fork_join(renderTiles);
+        else renderTiles();
+    }
+
+    // maps the first hits of each pixel, seen from the previous camera, to the pixel of the current camera that sees
+    // them. Pixels are sampled over [i, i + 1) / (width - 1) so their center is at i + 0.5
+    void ReprojectFilm(const camera& previous) {
+        const double w = film.width - 1;
+        const double h = film.height - 1;
+        film.Reproject([&](int x, int y, float depth, int& tx, int& ty, float& newDepth) {
+            const int j = (film.height - 1) - y;
+            const vec3 dir = previous.get_direction((x + 0.5) / w, (j + 0.5) / h);
+            double s, t, d;
+            if (depth > 0.0f) {
+                // depths are distances along the normalized camera ray
+                if (!cam.project(previous.getLookFrom() + depth * unit_vector(dir), s, t, d)) return false;
+                newDepth = (float)d;
+            }
+            else {
+                // the background only depends on the direction
+                if (!cam.project(cam.getLookFrom() + dir, s, t, d)) return false;
+                newDepth = std::numeric_limits<float>::infinity();
+            }
+            const double i = std::floor(s * w);
+            const double nj = std::floor(t * h);
+            if (i < 0 || i >= film.width || nj < 0 || nj >= film.height) return false;
+            tx = (int)i;
+            ty = (film.height - 1) - (int)nj;
+            return true;
+            }, maxHistory, historyDecay, depthTolerance, &pool);
+    }
+
+    void Dispatch() {
+        while (true) {
+            std::function<void()> pass;
+            {
+                std::unique_lock<std::mutex> lock(dispatchMutex);
+                dispatchCv.wait(lock, [this] { return quitDispatcher || pendingPass; });
+                if (quitDispatcher) return;
+                pass = std::move(pendingPass);
+                pendingPass = nullptr;
+            }
+            pass();
+        }
+    }
+
 public:
     pathtracer(camera& c, Film& film, scene_desc sc, unsigned md, unsigned rrd)
         : cam(c), film(film), scene(sc), max_depth(md), rroulette_depth(rrd), 
         seeds(film.width * film.height, 0) {
 
         initSeeds();
+        lineBands = { 0, (int)film.height };
 
         yocto::print_info("thread pool size = " + std::to_string(pool.get_thread_count()));
     }
 
+    // pins the render threads to cpus, filling one NUMA node after the other, then splits the lines in one band per
+    // node and moves the film and the seeds of each band to its node. Read only scene data stays where it was loaded
+    void PinThreads() {
+        topology = numa::topology::detect();
+        const auto cpus = topology.cpus();
+        const int threads = pool.get_thread_count();
+        std::vector<int> nodeThreads(topology.nodes.size(), 0);
+        int pinned = 0;
+        for (auto t = 0; t < threads; t++) {
+            const int cpu = cpus[t % cpus.size()];
+            if (!numa::pinThread(pool.get_native_handle(t), cpu)) continue;
+            nodeThreads[topology.nodeOf(cpu)]++;
+            pinned++;
+        }
+        yocto::print_info("pinned " + std::to_string(pinned) + " threads on " + std::to_string(topology.nodes.size()) + " NUMA nodes");
+        if (pinned == 0) return;
+
+        // bands are proportional to the threads of each node
+        lineBands.assign(1, 0);
+        int sum = 0;
+        for (auto n : nodeThreads) {
+            sum += n;
+            lineBands.push_back((int)((int64_t)film.height * sum / pinned));
+        }
+
+        const int bands = (int)lineBands.size() - 1;
+        decltype(seeds) newSeeds(seeds.size());
+        film.FirstTouch([&](auto&& copyRows) {
+            std::vector<std::atomic_int> next_line(bands);
+            for (auto b = 0; b < bands; b++) next_line[b] = lineBands[b];
+            auto copyBand = [&](int b) {
+                while (true) {
+                    const int j = next_line[b].fetch_add(1);
+                    if (j >= lineBands[b + 1]) break;
+                    copyRows((film.height - 1) - j, film.height - j);
+                    const auto begin = seeds.begin() + pixelIdx(0, j);
+                    std::copy(begin, begin + film.width, newSeeds.begin() + pixelIdx(0, j));
+                }
+            };
+
+            pool.fork_join([&] { copyBand(topology.nodeOf(numa::currentCpu())); });
+            // fork_join() doesn't guarantee a call per thread, the lines of the nodes none of whose threads ran one
+            // are copied from here
+            for (auto b = 0; b < bands; b++) copyBand(b);
+            });
+        seeds.swap(newSeeds);
+    }
+
+    ~pathtracer() {
+        StopJob();
+        if (!dispatcher.joinable()) return;
+        {
+            const std::lock_guard<std::mutex> lock(dispatchMutex);
+            quitDispatcher = true;
+        }
+        dispatchCv.notify_all();
+        dispatcher.join();
+    }
+
     virtual void Render(unsigned spp, bool parallel, callback::callback* cb) override {
+        StopJob();
+        PROFILE_EVENT("pass");
         if (parallel) {
-            std::atomic_int next_line(0);
-            for (auto t = 0; t < pool.get_thread_count(); ++t) {
-                pool.push_task([&] {
+            const int bands = (int)lineBands.size() - 1;
+            std::vector<std::atomic_int> next_line(bands);
+            for (auto b = 0; b < bands; b++) next_line[b] = lineBands[b];
+            pool.fork_join([&] {
+                ResetLocalStats();
+                wall_timer busy;
+                // threads start with the band of their node, then help with the other ones
+                const int home = bands > 1 ? topology.nodeOf(numa::currentCpu()) : 0;
+                for (auto k = 0; k < bands; k++) {
+                    const int b = (home + k) % bands;
                     while (true) {
-                        auto j = next_line.fetch_add(1);
-                        if (j >= film.height) break;
+                        auto j = next_line[b].fetch_add(1);
+                        if (j >= lineBands[b + 1]) break;
                         RenderLine(j, 0, film.width, spp, cb);
                     }
-                    });
-            }
-
-            pool.wait_for_tasks();
+                }
+                MergeLocalStats(busy.elapsed_seconds());
+                });
         }
         else {
+            ResetLocalStats();
+            wall_timer busy;
             for (unsigned j = 0; j < film.height; j++) RenderLine(j, 0, film.width, spp, cb);
+            MergeLocalStats(busy.elapsed_seconds());
         }
+        film.MarkDirty(0, 0, film.width, film.height);
+    }
+
+    virtual std::shared_ptr<render_job> RenderAsync(unsigned spp, bool parallel, callback::callback* cb) override {
+        StopJob();
+        job = std::make_shared<render_job>(MakeTiles());
+        if (!dispatcher.joinable()) dispatcher = std::thread(&pathtracer::Dispatch, this);
+        {
+            const std::lock_guard<std::mutex> lock(dispatchMutex);
+            pendingPass = [this, spp, parallel, cb, job = job] {
+                RenderTiles(*job, spp, parallel, cb);
+                job->Finish();
+            };
+        }
+        dispatchCv.notify_one();
+        return job;
+    }
+
+    // cancels the background pass and waits for the tiles it already started
+    void StopJob() {
+        if (!job) return;
+        job->Cancel();
+        // a pass that didn't start yet still finishes, without rendering any tile
+        job->Wait();
+        job = nullptr;
+    }
+
+    // only used by RenderAsync(), Render() always renders at full resolution
+    virtual void SetPreview(int size) override {
+        StopJob();
+        previewSize = std::max(size, 1);
     }
 
+    // read when a pass starts, the running one keeps its order
+    virtual void SetFocus(int x0, int y0, int x1, int y1, unsigned boost) override {
+        focusX0 = std::max(x0, 0);
+        focusY0 = std::max(y0, 0);
+        focusX1 = std::min(x1, (int)film.width);
+        focusY1 = std::min(y1, (int)film.height);
+        focusBoost = std::max(boost, 1u);
+    }
+
+    // camera moves keep the film's samples that are still visible, moved to their new pixels. It needs the first hit
+    // depths, so the film's AOVs are enabled. Pixels are only reprojected once they have been rendered with them
+    virtual void SetReprojection(bool enabled) override {
+        StopJob();
+        reproject = enabled;
+        if (reproject && !film.HasAOVs()) film.EnableAOVs();
+    }
+
+    void SetRaySorting(bool enabled) { sortRays = enabled; }
+    void SetBatchedShading(bool enabled) { batchShading = enabled; }
+
     virtual void DebugPixel(unsigned x, unsigned y, unsigned spp, callback::callback* cb) override {
         std::cerr << "\nDebugPixel(" << x << ", " << y << ")\n";
 
@@ -324,12 +993,34 @@ public:
     virtual void updateCamera(
         double from_x, double from_y, double from_z,
         double at_x, double at_y, double at_z) override {
+        // the running pass is dropped at its next tile, instead of being completed with a stale camera
+        StopJob();
+        if (!reproject) {
+            cam.update({ from_x, from_y, from_z }, { at_x, at_y, at_z });
+            Reset();
+            return;
+        }
+
+        // seeds keep going, so the new samples aren't correlated with the carried ones
+        const camera previous = cam;
         cam.update({ from_x, from_y, from_z }, { at_x, at_y, at_z });
-        Reset();
+        ReprojectFilm(previous);
+        const std::lock_guard<std::mutex> lock(statsMutex);
+        stats = {};
     }
 
     virtual void Reset() override {
+        StopJob();
         initSeeds();
         film.Clear();
+        const std::lock_guard<std::mutex> lock(statsMutex);
+        stats = {};
     }
+
+    virtual render_stats GetStats() const override {
+        const std::lock_guard<std::mutex> lock(statsMutex);
+        return stats;
+    }
+
+    virtual unsigned GetThreadCount() const override { return pool.get_thread_count(); }
 };
\ No newline at end of file
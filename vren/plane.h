@@ -12,7 +12,7 @@ public:
     plane(std::string name, const point3& o, const vec3& n, std::shared_ptr<material> m) :
         hittable(name + "_plane"), origin(o), norm(unit_vector(n)), mat_ptr(m) {}
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const override {
         double denom = dot(norm, r.direction());
 
         if (denom > -0.000001f) return false;
@@ -20,8 +20,13 @@ public:
         float t = dot(po, norm) / denom;
         if (t < t_min || t > t_max) return false;
 
-        rec.t = t;
-        rec.p = r.at(t);
+        cand.t = t;
+        return true;
+    }
+
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const override {
+        rec.t = cand.t;
+        rec.p = r.at(rec.t);
         rec.set_face_normal(r, norm);
 
         onb uv_onb = { norm };
@@ -29,8 +34,33 @@ public:
         rec.v = dot(rec.p, uv_onb.v());
 
         rec.mat_ptr = mat_ptr.get();
+    }
 
-        return true;
+    virtual void intersect_batch(ray_batch& b) const override {
+        const size_t n = b.size();
+        std::vector<double> ts(n);
+        std::vector<uint8_t> hits(n);
+        for (size_t i = 0; i < n; i++) {
+            const double denom = norm.x() * b.dx[i] + norm.y() * b.dy[i] + norm.z() * b.dz[i];
+            const double pox = origin.x() - b.ox[i];
+            const double poy = origin.y() - b.oy[i];
+            const double poz = origin.z() - b.oz[i];
+            // same float rounding as intersect()
+            const float t = (pox * norm.x() + poy * norm.y() + poz * norm.z()) / denom;
+            ts[i] = t;
+            hits[i] = !(denom > -0.000001f) && !(t < b.tmin[i] || t > b.tmax[i]);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (hits[i]) b.setHit(i, { ts[i], 0, 0, -1, id });
+        }
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        double denom = dot(norm, r.direction());
+        if (denom > -0.000001f) return false;
+        float t = dot(origin - r.origin(), norm) / denom;
+        return t >= t_min && t <= t_max;
     }
 
     const vec3 norm;
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ Hot path profiler, compiled out unless VREN_PROFILER is defined.
+ PROFILE_STAGE() accumulates the time spent in a scope into per thread counters, split by stage and bounce depth,
+ using the time stamp counter so a scope only costs a couple of instructions.
+ PROFILE_EVENT() records coarse scopes (passes, lines) that can be exported as a Chrome trace (chrome://tracing).
+*/
+namespace profiler {
+    enum Stage { Path, Intersect, Medium, Scatter, Envmap, Pdf, Rng, Sort, NumStages };
+
+    inline const char* stageName(int stage) {
+        static const char* names[] = { "path", "intersect", "medium", "scatter", "envmap", "pdf", "rng", "sort" };
+        return names[stage];
+    }
+
+    // deeper bounces are accumulated into the last bucket
+    const int maxDepth = 16;
+
+    // trace events kept per thread, the later ones are dropped so long interactive sessions don't grow forever
+    const size_t maxEvents = 1 << 16;
+
+    inline uint64_t ticks() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    struct trace_event {
+        const char* name;
+        uint64_t start, end;
+    };
+
+    struct thread_data {
+        int tid;
+        uint64_t cycles[NumStages][maxDepth] = {};
+        uint64_t calls[NumStages][maxDepth] = {};
+        std::vector<trace_event> events;
+    };
+
+    // owns the data of every thread that was profiled, so it outlives the threads
+    // the data of a thread that exited goes to the next thread that starts profiling, so threads that come and go
+    // don't add up
+    class registry {
+    private:
+        std::mutex mutex;
+        std::vector<std::unique_ptr<thread_data>> threads;
+        std::vector<thread_data*> released;
+
+        // ticks are converted to seconds by comparing them to the steady clock over the whole run
+        const uint64_t startTicks;
+        const std::chrono::steady_clock::time_point startTime;
+
+    public:
+        registry() : startTicks(ticks()), startTime(std::chrono::steady_clock::now()) {}
+
+        static registry& get() {
+            static registry r;
+            return r;
+        }
+
+        thread_data* add() {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (!released.empty()) {
+                thread_data* data = released.back();
+                released.pop_back();
+                return data;
+            }
+            threads.push_back(std::make_unique<thread_data>());
+            threads.back()->tid = (int)threads.size() - 1;
+            return threads.back().get();
+        }
+
+        // the counters and events are kept, they still count in the results
+        void release(thread_data* data) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            released.push_back(data);
+        }
+
+        double secondsPerTick() const {
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            const uint64_t elapsed = ticks() - startTicks;
+            return elapsed > 0 ? seconds / elapsed : 0.0;
+        }
+
+        // threads must not be profiling while the results are read or reset
+        void printBreakdown(std::ostream& o) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            const double toMs = secondsPerTick() * 1000.0;
+
+            uint64_t cycles[NumStages][maxDepth] = {};
+            uint64_t calls[NumStages] = {};
+            int depths = 0;
+            for (const auto& t : threads) {
+                for (auto s = 0; s < NumStages; s++) {
+                    for (auto d = 0; d < maxDepth; d++) {
+                        cycles[s][d] += t->cycles[s][d];
+                        calls[s] += t->calls[s][d];
+                        if (t->calls[s][d] > 0) depths = std::max(depths, d + 1);
+                    }
+                }
+            }
+
+            uint64_t stageCycles[NumStages] = {};
+            for (auto s = 0; s < NumStages; s++)
+                for (auto d = 0; d < maxDepth; d++) stageCycles[s] += cycles[s][d];
+            const double pathCycles = std::max((double)stageCycles[Path], 1.0);
+
+            // times are summed over all threads
+            o << std::fixed << std::setprecision(2);
+            o << std::left << std::setw(12) << "stage" << std::right << std::setw(14) << "calls"
+                << std::setw(14) << "total ms" << std::setw(10) << "% path" << std::setw(12) << "ns/call" << "\n";
+            for (auto s = 0; s < NumStages; s++) {
+                o << std::left << std::setw(12) << stageName(s) << std::right
+                    << std::setw(14) << calls[s]
+                    << std::setw(14) << stageCycles[s] * toMs
+                    << std::setw(10) << 100.0 * stageCycles[s] / pathCycles
+                    << std::setw(12) << (calls[s] > 0 ? stageCycles[s] * toMs * 1e6 / calls[s] : 0.0) << "\n";
+            }
+
+            o << "\n" << std::left << std::setw(8) << "depth" << std::right;
+            for (int s = Intersect; s < NumStages; s++) o << std::setw(12) << stageName(s);
+            o << "\n";
+            for (auto d = 0; d < depths; d++) {
+                o << std::left << std::setw(8) << (d == maxDepth - 1 ? std::to_string(d) + "+" : std::to_string(d))
+                    << std::right;
+                for (int s = Intersect; s < NumStages; s++) o << std::setw(12) << cycles[s][d] * toMs;
+                o << "\n";
+            }
+            o << "(ms, summed over threads)\n";
+        }
+
+        // time spent in each stage, summed over threads and depths
+        // threads must not be profiling while the results are read
+        std::vector<double> stageSeconds() {
+            const std::lock_guard<std::mutex> lock(mutex);
+            const double toSeconds = secondsPerTick();
+            std::vector<double> seconds(NumStages, 0.0);
+            for (const auto& t : threads)
+                for (auto s = 0; s < NumStages; s++)
+                    for (auto d = 0; d < maxDepth; d++) seconds[s] += t->cycles[s][d] * toSeconds;
+            return seconds;
+        }
+
+        // clears the stage counters, trace events are kept
+        void resetStages() {
+            const std::lock_guard<std::mutex> lock(mutex);
+            for (auto& t : threads) {
+                std::fill(&t->cycles[0][0], &t->cycles[0][0] + NumStages * maxDepth, 0);
+                std::fill(&t->calls[0][0], &t->calls[0][0] + NumStages * maxDepth, 0);
+            }
+        }
+
+        bool saveChromeTrace(const std::string& filename) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            std::ofstream out(filename);
+            if (!out) return false;
+
+            const double toUs = secondsPerTick() * 1e6;
+            out << "{\"traceEvents\":[\n";
+            bool first = true;
+            for (const auto& t : threads) {
+                for (const auto& e : t->events) {
+                    if (!first) out << ",\n";
+                    first = false;
+                    out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t->tid
+                        << ",\"ts\":" << (e.start - startTicks) * toUs
+                        << ",\"dur\":" << (e.end - e.start) * toUs << "}";
+                }
+            }
+            out << "\n]}\n";
+            return (bool)out;
+        }
+    };
+
+    // gives the thread's data back to the registry when the thread exits
+    struct thread_slot {
+        thread_data* const data = registry::get().add();
+        ~thread_slot() { registry::get().release(data); }
+    };
+
+    inline thread_data& local() {
+        static thread_local thread_slot slot;
+        return *slot.data;
+    }
+
+    // local() is called before reading the counter, so the registry exists before the first scope starts
+    class scoped_stage {
+    private:
+        thread_data& data;
+        const Stage stage;
+        const int depth;
+        const uint64_t start;
+
+    public:
+        scoped_stage(Stage stage, int depth) :
+            data(local()), stage(stage), depth(depth < maxDepth ? depth : maxDepth - 1), start(ticks()) {}
+
+        ~scoped_stage() {
+            data.cycles[stage][depth] += ticks() - start;
+            data.calls[stage][depth]++;
+        }
+    };
+
+    class scoped_event {
+    private:
+        thread_data& data;
+        const char* name;
+        const uint64_t start;
+
+    public:
+        scoped_event(const char* name) : data(local()), name(name), start(ticks()) {}
+
+        ~scoped_event() {
+            if (data.events.size() < maxEvents) data.events.push_back({ name, start, ticks() });
+        }
+    };
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef VREN_PROFILER
+#define PROFILE_STAGE(stage, depth) profiler::scoped_stage PROFILE_CONCAT(profile_stage_, __LINE__)(stage, depth)
+#define PROFILE_EVENT(name) profiler::scoped_event PROFILE_CONCAT(profile_event_, __LINE__)(name)
+#else
+#define PROFILE_STAGE(stage, depth)
+#define PROFILE_EVENT(name)
+#endif
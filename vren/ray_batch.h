@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "ray.h"
+#include "hit_record.h"
+
+/*
+ Rays in structure of arrays layout, so intersection kernels can loop over one component at a time.
+ tmax shrinks to the closest hit found so far, which lets every object of a hittable_list intersect the whole
+ batch in turn and still end up with the closest hit of each ray.
+*/
+struct ray_batch {
+    std::vector<double> ox, oy, oz;
+    std::vector<double> dx, dy, dz; // unit directions, as in ray
+    std::vector<double> tmin, tmax;
+
+    std::vector<hit_candidate> hits;
+    std::vector<uint8_t> found;
+
+    ray_batch(size_t size = 0) { resize(size); }
+
+    size_t size() const { return ox.size(); }
+
+    void resize(size_t size) {
+        for (auto v : { &ox, &oy, &oz, &dx, &dy, &dz, &tmin, &tmax }) v->resize(size);
+        hits.resize(size);
+        found.resize(size);
+    }
+
+    // also clears the ray's hit
+    void set(size_t i, const ray& r, double t_min, double t_max) {
+        ox[i] = r.orig.x(); oy[i] = r.orig.y(); oz[i] = r.orig.z();
+        dx[i] = r.dir.x(); dy[i] = r.dir.y(); dz[i] = r.dir.z();
+        tmin[i] = t_min;
+        tmax[i] = t_max;
+        hits[i] = {};
+        found[i] = 0;
+    }
+
+    ray get(size_t i) const {
+        // the direction is already normalized, don't go through ray's constructor
+        ray r;
+        r.orig = { ox[i], oy[i], oz[i] };
+        r.dir = { dx[i], dy[i], dz[i] };
+        return r;
+    }
+
+    // records a hit closer than the ray's current tmax
+    void setHit(size_t i, const hit_candidate& cand) {
+        hits[i] = cand;
+        tmax[i] = cand.t;
+        found[i] = 1;
+    }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "vec3.h"
+
+/*
+ Reorders rays so the ones that are likely to visit the same BVH nodes are intersected one after the other.
+ Rays are grouped by the octant of their direction first, then by their origin along a morton curve that
+ spans the bounds of all the origins. Secondary rays come out of the renderer in pixel order, which is almost
+ random once they left a curved surface, sorting them keeps the traversal of consecutive rays in cache.
+*/
+
+// spreads the lower 10 bits of v so there are 2 zero bits between each of them
+inline uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30 bits morton code of a point inside the unit cube
+inline uint32_t morton3(double x, double y, double z) {
+    auto quantize = [](double c) { return (uint32_t)std::min(std::max(c * 1024.0, 0.0), 1023.0); };
+    return (expandBits(quantize(x)) << 2) | (expandBits(quantize(y)) << 1) | expandBits(quantize(z));
+}
+
+inline uint32_t directionOctant(const vec3& d) {
+    return (d.x() < 0 ? 4 : 0) | (d.y() < 0 ? 2 : 0) | (d.z() < 0 ? 1 : 0);
+}
+
+// sorts indices by coherence, origin(i) and direction(i) return the origin and direction of ray i
+template<typename Origin, typename Direction>
+void sortByCoherence(std::vector<int>& indices, Origin&& origin, Direction&& direction) {
+    if (indices.size() < 2) return;
+
+    point3 lo = origin(indices[0]);
+    point3 hi = lo;
+    for (auto i : indices) {
+        const point3 o = origin(i);
+        for (auto a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], o[a]);
+            hi[a] = std::max(hi[a], o[a]);
+        }
+    }
+    vec3 scale;
+    for (auto a = 0; a < 3; a++) scale[a] = hi[a] > lo[a] ? 1.0 / (hi[a] - lo[a]) : 0.0;
+
+    std::vector<std::pair<uint64_t, int>> keys;
+    keys.reserve(indices.size());
+    for (auto i : indices) {
+        const point3 o = origin(i);
+        const uint64_t code = morton3((o.x() - lo.x()) * scale.x(), (o.y() - lo.y()) * scale.y(), (o.z() - lo.z()) * scale.z());
+        keys.push_back({ ((uint64_t)directionOctant(direction(i)) << 30) | code, i });
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for (auto k = 0; k < keys.size(); k++) indices[k] = keys[k].second;
+}
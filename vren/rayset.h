@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+
+#include <yocto/yocto_math.h>
+#include <yocto/yocto_geometry.h>
+#include <yocto/yocto_cli.h>
+
+/*
+ Rays captured from a real render, grouped by the bounce that generated them.
+ Used to replay the same ray distribution against the intersection kernels.
+*/
+class RaySet {
+public:
+    enum Kind { Primary = 0, Diffuse, Specular, NumKinds };
+
+    static const char* kindName(int kind) {
+        switch (kind) {
+        case Primary: return "primary";
+        case Diffuse: return "diffuse";
+        case Specular: return "specular";
+        default: return "unknown";
+        }
+    }
+
+    RaySet() {}
+
+    RaySet(std::string filename) {
+        std::fstream in(filename, std::ios::in | std::ios::binary);
+
+        const char* HEADER = "RAYS_00.01";
+        int headerLen = strlen(HEADER) + 1;
+        std::vector<char> header(headerLen);
+        in.read(header.data(), headerLen);
+        if (!in || strcmp(HEADER, header.data()) != 0) {
+            yocto::print_fatal("invalid ray set: " + filename);
+        }
+
+        for (auto& set : rays) {
+            unsigned count;
+            in.read((char*)&count, sizeof(unsigned));
+            set.resize(count);
+            in.read((char*)set.data(), sizeof(yocto::ray3f) * count);
+        }
+    }
+
+    void saveToFile(std::string filename) const {
+        std::fstream out(filename, std::ios::out | std::ios::binary);
+        const char* HEADER = "RAYS_00.01";
+        out.write(HEADER, strlen(HEADER) + 1);
+        for (const auto& set : rays) {
+            unsigned count = set.size();
+            out.write((char*)&count, sizeof(unsigned));
+            out.write((char*)set.data(), sizeof(yocto::ray3f) * count);
+        }
+    }
+
+    void add(Kind kind, const yocto::ray3f& r) {
+        rays[kind].push_back(r);
+    }
+
+    std::vector<yocto::ray3f> rays[NumKinds];
+};
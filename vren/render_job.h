@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+// rectangle of a pass, lines [j0, j1) and columns [x0, x1). Lines are counted from the bottom of the film
+struct render_tile {
+    int x0, j0, x1, j1;
+    unsigned boost = 1; // the tile's pixels get boost times the pass' samples
+};
+
+/*
+ Progress and control of an asynchronous render pass, see tracer::RenderAsync().
+ The pass is split in tiles that the render threads pull in order, cancelling the job stops them
+ before their next tile so a stale pass can be dropped without waiting for it to finish.
+*/
+class render_job {
+private:
+    const std::vector<render_tile> tiles;
+    std::atomic<int> nextTile{ 0 };
+    std::atomic<int> tilesDone{ 0 };
+    std::atomic<bool> cancelled{ false };
+
+    std::mutex mutex;
+    std::condition_variable finishedCv;
+    bool finished = false;
+
+public:
+    render_job(std::vector<render_tile> tiles) : tiles(std::move(tiles)) {}
+
+    // the running tiles are completed, the pass doesn't start any other one
+    void Cancel() { cancelled = true; }
+
+    bool IsCancelled() const { return cancelled; }
+
+    // true once every render thread stopped, whether the pass was completed or cancelled
+    bool IsFinished() {
+        const std::lock_guard<std::mutex> lock(mutex);
+        return finished;
+    }
+
+    // true if all the tiles were rendered
+    bool IsComplete() const { return tilesDone == (int)tiles.size(); }
+
+    // fraction of the tiles that are rendered
+    float Progress() const {
+        return tiles.empty() ? 1.0f : (float)tilesDone / tiles.size();
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finishedCv.wait(lock, [this] { return finished; });
+    }
+
+    // used by the tracer's render threads
+
+    // next tile to render, false when the pass is over or cancelled
+    bool NextTile(render_tile& tile) {
+        if (cancelled) return false;
+        const int t = nextTile.fetch_add(1);
+        if (t >= (int)tiles.size()) return false;
+        tile = tiles[t];
+        return true;
+    }
+
+    void TileDone() { tilesDone++; }
+
+    void Finish() {
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        finishedCv.notify_all();
+    }
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_cli.h>
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "plane.h"
+#include "box.h"
+#include "material.h"
+#include "texture.h"
+#include "model.h"
+#include "measured_mediums.h"
+
+using std::string;
+using std::make_shared;
+using std::shared_ptr;
+
+/*
+ Canonical scenes shared by vren-gui and vren-bench.
+ Model and hdr paths are relative to the working directory.
+*/
+
+void moriKnob(hittable_list& world) {
+    auto obj = yocto::obj_model{};
+    auto error = string{};
+    if (!yocto::load_obj("models/mori-knob.obj", obj, error))
+        yocto::print_fatal("failed to load model: " + error);
+    for (auto shape : obj.shapes) {
+        if (shape.name == "BasePlane_basePlane") {
+            auto mat = make_shared<lambertian>(color(0.8));
+
+            world.add(make_shared<model>(shape, mat));
+        }
+        else if (shape.name == "InnerSphere_innerSphere") {
+            auto mat = make_shared<lambertian>(color(0.2));
+
+            world.add(make_shared<model>(shape, mat));
+        }
+        else if (shape.name == "OuterSphere_outerSphere" || shape.name == "ObjBase_objBase") {
+            // glass with ketchup
+            vec3 sigma_s, sigma_a;
+            GetMediumScatteringProperties("Ketchup", sigma_a, sigma_s);
+            auto scale = 400.0f;
+            auto ketchup = make_shared<HomogeneousMedium>(sigma_a * scale, sigma_s * scale);
+            auto mat = make_shared<dielectric>(1.35, ketchup);
+
+            world.add(make_shared<model>(shape, mat));
+        }
+        else {
+            yocto::print_info("Ignoring shape: " + shape.name);
+        }
+    }
+}
+
+void simple_box(hittable_list& objects, shared_ptr<hittable> light, bool add_light) {
+
+    // auto material_ground = make_shared<lambertian>(color(0.4));
+    shared_ptr<texture> checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    auto material_ground = make_shared<lambertian>(checker);
+    objects.add(make_shared<plane>("floor", point3(0.0, -0.101, 0.0), vec3(0.0, 1.0, 0.0), material_ground));
+
+    shared_ptr<material> mat;
+
+    int type = 3;
+    switch (type) {
+        case 0: {
+            // red diffuse
+            mat = make_shared<lambertian>(color(0.5, 0.1, 0.1));
+            break;
+        }
+        case 1: {
+            // dark grey diffuse
+            mat = make_shared<lambertian>(color(0.1));
+            break;
+        }
+        case 2: {
+            // glass with ketchup
+            vec3 sigma_s, sigma_a;
+            GetMediumScatteringProperties("Ketchup", sigma_a, sigma_s);
+            auto scale = 100.0f;
+            auto ketchup = make_shared<HomogeneousMedium>(sigma_a * scale, sigma_s * scale);
+            mat = make_shared<dielectric>(1.35, ketchup);
+            break;
+        }
+        case 3: {
+            // passthrough with ketchup
+            vec3 sigma_s, sigma_a;
+            GetMediumScatteringProperties("Ketchup", sigma_a, sigma_s);
+            auto scale = 100.0f;
+            auto ketchup = make_shared<HomogeneousMedium>(sigma_a * scale, sigma_s * scale);
+            mat = make_shared<passthrough>(ketchup);
+            break;
+        }
+    }
+
+    objects.add(make_shared<box>("base", point3(), vec3(1.0, 0.1, 1.0), mat));
+
+    if (add_light) {
+        auto material_light = make_shared<diffuse_light>(color(20.0));
+        light = make_shared<sphere>("light", point3(0.0, 15, 1.0), 0.5, material_light);
+        objects.add(light);
+    }
+
+}
+
+void glass_panels(hittable_list& objects, bool scattering_medium = false) {
+    // white diffuse floor
+    auto material_ground = make_shared<lambertian>(color(0.8));
+    //shared_ptr<texture> checker = make_shared<checker_texture>(color(0.1, 0.1, 0.1), color(1.0, 1.0, 1.0));
+    //auto material_ground = make_shared<lambertian>(checker);
+    objects.add(make_shared<plane>("floor", point3(0.0, -0.005, 0.0), vec3(0.0, 1.0, 0.0), material_ground));
+
+    float c = 1.0;  // this allows us to adjust the filter color without changing the hue
+    color glass_color(0.27 * c, 0.49 * c, 0.42 * c);
+
+    shared_ptr<Medium> medium{};
+    if (scattering_medium) {
+        vec3 sigma_s, sigma_a;
+        GetMediumScatteringProperties("Ketchup", sigma_a, sigma_s);
+        auto scale = 1.0f;
+        medium = make_shared<HomogeneousMedium>(sigma_a * scale, sigma_s * scale);
+    }
+    else 
+        medium = make_shared<NoScatterMedium>(glass_color, 0.25);
+    auto tinted_glass = make_shared<dielectric>(1.5, medium);
+
+    for (auto i : yocto::range(5)) {
+        objects.add(make_shared<box>("panel1", point3(0.0, 0.5, 1.0 - i*0.5), vec3(1.0, 1.0, 0.1), tinted_glass));
+    }
+}
+
+void dragon_scene(hittable_list& objects, bool scattering_medium = false) {
+    auto material_ground = make_shared<lambertian>(color(0.6));
+    //shared_ptr<texture> checker = make_shared<checker_texture>(color(0.1), color(0.8));
+    //auto material_ground = make_shared<lambertian>(checker);
+    objects.add(make_shared<plane>("floor", point3(0.0, 0.1, 0.0), vec3(0.0, 1.0, 0.0), material_ground));
+
+    float c = 1.0;  // this allows us to adjust the filter color without changing the hue
+    color glass_color(0.27 * c, 0.49 * c, 0.42 * c);
+
+    shared_ptr<Medium> medium{};
+    if (scattering_medium) {
+        vec3 sigma_s, sigma_a;
+        GetMediumScatteringProperties("Ketchup", sigma_a, sigma_s);
+        auto scale = 1.0f;
+        medium = make_shared<HomogeneousMedium>(sigma_a * scale, sigma_s * scale);
+    }
+    else
+        medium = make_shared<NoScatterMedium>(glass_color, 0.25);
+    auto tinted_glass = make_shared<dielectric>(1.5, medium);
+
+    //auto m = make_shared<metal>(color(0.97, 0.96, 0.91));
+    //auto m = make_shared<lambertian>(color(glass_color));
+
+    auto frame = 
+        yocto::translation_frame({ -0.5f, 0.5f, 0.0f }) *
+        yocto::rotation_frame({ 0.0f, 1.0f, 0.0f }, yocto::radians(-45.0f)) *
+        yocto::rotation_frame({ 1.0f, 0.0f, 0.0f }, yocto::radians(-37.5f)) *
+        yocto::rotation_frame({ 0.0f, 0.0f, 1.0f }, yocto::radians(90.0f)) *
+        yocto::rotation_frame(toYocto(unit_vector({ 1.0f, 0.0f, -1.0f })), yocto::radians(-2.0f)) *
+        yocto::scaling_frame({ 1 / 100.0f, 1 / 100.0f, 1 / 100.0f });
+    auto dragon = make_shared<model>("models/dragon_remeshed.ply", tinted_glass, frame);
+    //auto dragon = make_shared<BVHModel>("models/dragon_remeshed.ply", tinted_glass, frame);
+    objects.add(dragon);
+}
+
+void monk_scene(hittable_list& objects, bool scattering_medium = false) {
+    //auto material_ground = make_shared<lambertian>(color(0.75));
+    shared_ptr<texture> checker = make_shared<checker_texture>(color(0.1), color(0.8));
+    auto material_ground = make_shared<lambertian>(checker);
+    objects.add(make_shared<plane>("floor", point3(0.0, -0.505, 0.0), vec3(0.0, 1.0, 0.0), material_ground));
+
+    float c = 1.0;  // this allows us to adjust the filter color without changing the hue
+    color glass_color(0.27 * c, 0.49 * c, 0.42 * c);
+
+    shared_ptr<Medium> medium{};
+    if (scattering_medium) {
+        vec3 sigma_s, sigma_a;
+        GetMediumScatteringProperties("Ketchup", sigma_a, sigma_s);
+        auto scale = 1.0f;
+        medium = make_shared<HomogeneousMedium>(sigma_a * scale, sigma_s * scale);
+    }
+    else
+        medium = make_shared<NoScatterMedium>(glass_color, 0.25);
+    auto monk_mat = make_shared<dielectric>(1.5, medium);
+    //auto monk_mat = make_shared<diffuse_subsurface_scattering>(glass_color, medium);
+    //auto monk_mat = make_shared<lambertian>(glass_color);
+
+    auto frame = 
+        yocto::translation_frame(toYocto(point3(0.0, -0.5, -0.5))) *
+        yocto::rotation_frame({ 1.0f, 0.0f, 0.0f }, -yocto::pif / 2) *
+        yocto::scaling_frame({ 0.01f, 0.01f, 0.01f });    
+    auto monk = make_shared<model>("models/LuYu-obj/LuYu-obj.obj", monk_mat, frame);
+    objects.add(monk);
+}
+
+struct scene_settings {
+    point3 lookfrom;
+    point3 lookat;
+    double vfov = 40.0;
+    double aperture = 0.0;
+    color background{ 0, 0, 0 };
+};
+
+const std::vector<std::string> scene_names = {
+    "simple_box", "monk_scene", "glass_panels", "dragon_scene", "moriKnob"
+};
+
+// builds one of the scene_names into world, returns false if name is unknown
+bool load_scene(const std::string& name, hittable_list& world, scene_settings& settings) {
+    if (name == "simple_box") {
+        simple_box(world, {}, false);
+        //lookfrom = point3(3, 2, 2);
+        settings.lookfrom = point3(3.68871, 1.71156, 3.11611);
+        settings.lookat = point3(0, 0, 0);
+        settings.vfov = 20.0;
+        settings.aperture = 0.1;
+        settings.background = color(0.6, 0.6, 0.7);
+    }
+    else if (name == "monk_scene") {
+        monk_scene(world, true);
+        settings.lookfrom = point3(-8.49824, 3.01965, -2.37236);
+        settings.lookat = point3(0, 0.75, -0.75);
+        settings.vfov = 20.0;
+        settings.aperture = 0.1;
+        settings.background = color(0.6, 0.6, 0.7);
+    }
+    else if (name == "glass_panels") {
+        glass_panels(world, false);
+        settings.lookfrom = point3(1.97006, 2.41049, 7.12357);
+        settings.lookat = point3(0, 0.5, 0);
+        settings.vfov = 20.0;
+        settings.aperture = 0.1;
+        settings.background = color(1.0, 1.0, 1.0);
+    }
+    else if (name == "dragon_scene") {
+        dragon_scene(world, false);
+        // lookfrom = point3(-4.35952, 2.64187, 4.06531);
+        //lookfrom = { 4.31991, 4.0518, -2.75208 };
+        settings.lookfrom = { 2.27155, 7.99803, 0.244723 };
+        settings.lookat = point3(-0.5, 0, -0.5);
+        settings.vfov = 20.0;
+        settings.aperture = 0.0;
+        settings.background = color(0.6, 0.6, 0.7);
+    }
+    else if (name == "moriKnob") {
+        moriKnob(world);
+        settings.lookfrom = point3(-0.594562, 1.10331, -0.793232);
+        settings.lookat = point3(0, 0.1, 0);
+        settings.vfov = 20.0;
+        settings.aperture = 0.0;
+        settings.background = color(0.6, 0.6, 0.7);
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
\ No newline at end of file
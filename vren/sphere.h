@@ -10,7 +10,20 @@ public:
     sphere(std::string name, point3 cen, double r, shared_ptr<material> m) :
         hittable(name), center(cen), radius(r), mat_ptr(m) {}
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool intersect(const ray& r, double t_min, double t_max, hit_candidate& cand) const override {
+        return findRoot(r, t_min, t_max, cand.t);
+    }
+    virtual void resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const override;
+    virtual void intersect_batch(ray_batch& batch) const override;
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        double root;
+        return findRoot(r, t_min, t_max, root);
+    }
+    virtual bool bounding_box(point3& lo, point3& hi) const override {
+        lo = center - vec3(radius, radius, radius);
+        hi = center + vec3(radius, radius, radius);
+        return true;
+    }
     virtual double pdf_value(const point3& o, const vec3& v) const override;
     virtual std::string pdf_name()const override {
         return name;
@@ -19,6 +32,26 @@ public:
     virtual vec3 random(const point3& o, rnd& rng) override;
 
 private:
+    // nearest intersection in [t_min, t_max]
+    bool findRoot(const ray& r, double t_min, double t_max, double& root) const {
+        vec3 oc = r.origin() - center;
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = half_b * half_b - c;
+        if (discriminant < 0) return false;
+        auto sqrtd = sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range.
+        root = (-half_b - sqrtd);
+        if (root < t_min || t_max < root) {
+            root = (-half_b + sqrtd);
+            if (root < t_min || t_max < root)
+                return false;
+        }
+        return true;
+    }
+
     static void get_sphere_uv(const point3& p, double& u, double& v) {
         // p: a given point on the sphere of radius one, centered at the origin.
         // u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -40,31 +73,41 @@ public:
     shared_ptr<material> mat_ptr;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center;
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius * radius;
-
-    auto discriminant = half_b * half_b - c;
-    if (discriminant < 0) return false;
-    auto sqrtd = sqrt(discriminant);
-
-    // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd);
-    if (root < t_min || t_max < root) {
-        root = (-half_b + sqrtd);
-        if (root < t_min || t_max < root)
-            return false;
-    }
-
-    rec.t = root;
+void sphere::resolve(const ray& r, const hit_candidate& cand, hit_record& rec) const {
+    rec.t = cand.t;
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
     rec.mat_ptr = mat_ptr.get();
+}
 
-    return true;
+// same math as findRoot(), written without branches so the loop vectorizes
+void sphere::intersect_batch(ray_batch& b) const {
+    const size_t n = b.size();
+    std::vector<double> roots(n);
+    std::vector<uint8_t> hits(n);
+    for (size_t i = 0; i < n; i++) {
+        const double ocx = b.ox[i] - center.x();
+        const double ocy = b.oy[i] - center.y();
+        const double ocz = b.oz[i] - center.z();
+        const double half_b = ocx * b.dx[i] + ocy * b.dy[i] + ocz * b.dz[i];
+        const double c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+
+        const double discriminant = half_b * half_b - c;
+        const double sqrtd = std::sqrt(discriminant < 0 ? 0.0 : discriminant);
+        const double r0 = -half_b - sqrtd;
+        const double r1 = -half_b + sqrtd;
+        const bool in0 = !(r0 < b.tmin[i] || b.tmax[i] < r0);
+        const bool in1 = !(r1 < b.tmin[i] || b.tmax[i] < r1);
+
+        roots[i] = in0 ? r0 : r1;
+        hits[i] = discriminant >= 0 && (in0 || in1);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (hits[i]) b.setHit(i, { roots[i], 0, 0, -1, id });
+    }
 }
 
 double sphere::pdf_value(const point3& o, const vec3& v) const {
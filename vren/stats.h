@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+// measures wall clock time, unlike clock() which adds up the cpu time of all threads
+class wall_timer {
+private:
+    std::chrono::steady_clock::time_point start;
+
+public:
+    wall_timer() : start(std::chrono::steady_clock::now()) {}
+
+    void reset() { start = std::chrono::steady_clock::now(); }
+
+    double elapsed_seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// cost of BVHAccel traversals, summed over rays
+struct traversal_stats {
+    uint64_t rays = 0;
+    uint64_t nodes = 0;     // interior nodes visited
+    uint64_t leaves = 0;    // leaf nodes visited
+    uint64_t triangles = 0; // ray-triangle tests
+    uint64_t max_stack = 0; // deepest traversal stack, in nodes
+
+    traversal_stats& operator+=(const traversal_stats& s) {
+        rays += s.rays;
+        nodes += s.nodes;
+        leaves += s.leaves;
+        triangles += s.triangles;
+        max_stack = std::max(max_stack, s.max_stack);
+        return *this;
+    }
+};
+
+#ifdef VREN_BVH_STATS
+// BVHAccel::hit() counts every traversal into the calling thread's stats
+inline traversal_stats& thread_traversal_stats() {
+    static thread_local traversal_stats stats;
+    return stats;
+}
+#endif
+
+// work done by a tracer since its last Reset()
+struct render_stats {
+    uint64_t paths = 0; // camera samples
+    uint64_t rays = 0;  // scene intersection queries, including the ones inside mediums
+    uint64_t bounces = 0; // path vertices, counts the last query of a path even when it misses the scene
+    double busy_seconds = 0.0; // time the render threads spent rendering, summed over the threads
+    traversal_stats traversal; // only counted when built with VREN_BVH_STATS
+
+    render_stats& operator+=(const render_stats& s) {
+        paths += s.paths;
+        rays += s.rays;
+        bounces += s.bounces;
+        busy_seconds += s.busy_seconds;
+        traversal += s.traversal;
+        return *this;
+    }
+};
+
+// time spent building acceleration structures since the program started
+// scenes are loaded from a single thread, so this doesn't need to be atomic
+inline double total_bvh_build_seconds = 0.0;
@@ -16,6 +16,7 @@
 
 #include <atomic>      // std::atomic
 #include <chrono>      // std::chrono
+#include <condition_variable> // std::condition_variable
 #include <cstdint>     // std::int_fast64_t, std::uint_fast32_t
 #include <functional>  // std::function
 #include <future>      // std::future, std::promise
@@ -32,6 +33,7 @@
 
 /**
  * @brief A C++17 thread pool class. The user submits tasks to be executed into a queue. Whenever a thread becomes available, it pops a task from the queue and executes it. Each task is automatically assigned a future, which can be used to wait for the task to finish executing and/or obtain its eventual return value.
+ * @details Modified for vren: idle workers and waiting threads spin for a short while, then park on a condition variable instead of polling with sleep_or_yield(). A short render pass is dispatched and joined in microseconds, and an idle pool doesn't use any CPU.
  */
 class thread_pool
 {
@@ -60,7 +62,7 @@ public:
     ~thread_pool()
     {
         wait_for_tasks();
-        running = false;
+        stop_threads();
         destroy_threads();
     }
 
@@ -109,6 +111,17 @@ public:
         return thread_count;
     }
 
+    /**
+     * @brief Get the native handle of a thread in the pool, e.g. to set its affinity. Handles are invalidated by reset().
+     *
+     * @param i The index of the thread, less than get_thread_count().
+     * @return The native handle of the thread.
+     */
+    std::thread::native_handle_type get_native_handle(const ui32 i)
+    {
+        return threads[i].native_handle();
+    }
+
     /**
      * @brief Parallelize a loop by splitting it into blocks, submitting each block separately to the thread pool, and waiting for all blocks to finish executing. The user supplies a loop function, which will be called once per block and should iterate over the block's range.
      *
@@ -156,10 +169,30 @@ public:
                           blocks_running--;
                       });
         }
-        while (blocks_running != 0)
+        wait_for_zero(blocks_running);
+    }
+
+    /**
+     * @brief Submit a function thread_count times and wait for all of these calls to return. Only waits for these tasks, not for others that may be in the queue. Meant for fork/join passes where each call pulls its own work, e.g. lines from a shared atomic counter, until none is left.
+     * The calls are queued like any other task: a thread may run several of them while another one runs none, so they are neither guaranteed to run once per thread nor concurrently.
+     *
+     * @tparam F The type of the function.
+     * @param task The function to run. Called thread_count times.
+     */
+    template <typename F>
+    void fork_join(const F &task)
+    {
+        std::atomic<ui32> tasks_running = thread_count;
+        for (ui32 t = 0; t < thread_count; t++)
         {
-            sleep_or_yield();
+            push_task([&task, &tasks_running]
+                      {
+                          task();
+                          tasks_running--;
+                      });
         }
+        // tasks_running is decremented last, the join can't return while a task still reads it
+        wait_for_zero(tasks_running);
     }
 
     /**
@@ -175,7 +208,9 @@ public:
         {
             const std::scoped_lock lock(queue_mutex);
             tasks.push(std::function<void()>(task));
+            tasks_queued++;
         }
+        task_available.notify_one();
     }
 
     /**
@@ -204,7 +239,7 @@ public:
         bool was_paused = paused;
         paused = true;
         wait_for_tasks();
-        running = false;
+        stop_threads();
         destroy_threads();
         thread_count = _thread_count ? _thread_count : std::thread::hardware_concurrency();
         threads.reset(new std::thread[thread_count]);
@@ -288,18 +323,14 @@ public:
      */
     void wait_for_tasks()
     {
-        while (true)
+        if (!paused)
+        {
+            wait_for_zero(tasks_total);
+            return;
+        }
+        // pausing doesn't notify anyone, so poll while paused
+        while (get_tasks_running() != 0)
         {
-            if (!paused)
-            {
-                if (tasks_total == 0)
-                    break;
-            }
-            else
-            {
-                if (get_tasks_running() == 0)
-                    break;
-            }
             sleep_or_yield();
         }
     }
@@ -314,10 +345,15 @@ public:
     std::atomic<bool> paused = false;
 
     /**
-     * @brief The duration, in microseconds, that the worker function should sleep for when it cannot find any tasks in the queue. If set to 0, then instead of sleeping, the worker function will execute std::this_thread::yield() if there are no tasks in the queue. The default value is 1000.
+     * @brief The duration, in microseconds, that the pool polls for when it can't be notified: workers while the pool is paused, and wait_for_tasks() while paused. If set to 0, then instead of sleeping, std::this_thread::yield() is executed. The default value is 1000.
      */
     ui32 sleep_duration = 1000;
 
+    /**
+     * @brief The maximum duration, in microseconds, that an idle worker or a waiting thread spins before parking on a condition variable. Spinning catches the next task of back to back passes without a wakeup. Each worker halves its own spin every time it parks and goes back to the maximum whenever it runs a task, so a pool that stays idle stops spinning quickly and starts again with the next pass. If set to 0, threads park right away. The default value is 200.
+     */
+    std::atomic<ui32> spin_duration = 200;
+
 private:
     // ========================
     // Private member functions
@@ -334,6 +370,18 @@ private:
         }
     }
 
+    /**
+     * @brief Tell the workers to stop, waking up the ones that are parked.
+     */
+    void stop_threads()
+    {
+        {
+            const std::scoped_lock lock(queue_mutex);
+            running = false;
+        }
+        task_available.notify_all();
+    }
+
     /**
      * @brief Destroy the threads in the pool by joining them.
      */
@@ -360,6 +408,7 @@ private:
         {
             task = std::move(tasks.front());
             tasks.pop();
+            tasks_queued--;
             return true;
         }
     }
@@ -377,22 +426,78 @@ private:
     }
 
     /**
-     * @brief A worker function to be assigned to each thread in the pool. Continuously pops tasks out of the queue and executes them, as long as the atomic variable running is set to true.
+     * @brief Spin until a condition is true or the spin duration is over.
+     *
+     * @param spin The maximum duration to spin for, in microseconds.
+     * @param done The condition. Should be cheap to evaluate, it is checked continuously.
+     * @return true if the condition became true.
+     */
+    template <typename F>
+    static bool spin_until(const ui32 spin, const F &done)
+    {
+        if (done())
+            return true;
+        if (spin == 0)
+            return false;
+        const auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(spin);
+        do
+        {
+            std::this_thread::yield();
+            if (done())
+                return true;
+        } while (std::chrono::steady_clock::now() < end);
+        return false;
+    }
+
+    /**
+     * @brief Wait for a counter of unfinished tasks to reach zero. Spins first, then parks until the thread that decrements it to zero notifies tasks_done.
+     *
+     * @param counter The counter to wait for. Must only be decremented by tasks of this pool, see worker().
+     */
+    void wait_for_zero(const std::atomic<ui32> &counter)
+    {
+        if (spin_until(spin_duration, [&counter] { return counter == 0; }))
+            return;
+        std::unique_lock lock(done_mutex);
+        tasks_done.wait(lock, [&counter] { return counter == 0; });
+    }
+
+    /**
+     * @brief A worker function to be assigned to each thread in the pool. Continuously pops tasks out of the queue and executes them, as long as the atomic variable running is set to true. When the queue is empty, spins for a while then parks until a task is pushed.
      */
     void worker()
     {
+        ui32 spin = spin_duration;
         while (running)
         {
             std::function<void()> task;
             if (!paused && pop_task(task))
             {
+                spin = spin_duration;
                 task();
                 tasks_total--;
+                // a task may have decremented a parallelize_loop() or fork_join() counter to zero as well,
+                // taking the mutex orders the notification after the waiter checked its counter
+                {
+                    const std::scoped_lock lock(done_mutex);
+                }
+                tasks_done.notify_all();
+                continue;
             }
-            else
+
+            if (paused)
             {
-                sleep_or_yield();
+                std::unique_lock lock(queue_mutex);
+                task_available.wait_for(lock, std::chrono::microseconds(sleep_duration ? sleep_duration : 1));
+                continue;
             }
+
+            if (spin_until(spin, [this] { return !running || (!paused && tasks_queued != 0); }))
+                continue;
+
+            spin /= 2;
+            std::unique_lock lock(queue_mutex);
+            task_available.wait(lock, [this] { return !running || paused || !tasks.empty(); });
         }
     }
 
@@ -405,11 +510,31 @@ private:
      */
     mutable std::mutex queue_mutex = {};
 
+    /**
+     * @brief Notified when a task is pushed into the queue, or when the workers should stop. Parked workers wait on it.
+     */
+    std::condition_variable task_available = {};
+
+    /**
+     * @brief A mutex for the threads that wait for tasks to finish.
+     */
+    std::mutex done_mutex = {};
+
+    /**
+     * @brief Notified when a task finishes. Threads waiting in wait_for_tasks(), parallelize_loop() and fork_join() park on it.
+     */
+    std::condition_variable tasks_done = {};
+
     /**
      * @brief An atomic variable indicating to the workers to keep running. When set to false, the workers permanently stop working.
      */
     std::atomic<bool> running = true;
 
+    /**
+     * @brief The number of tasks in the queue, so spinning workers can check the queue without locking it.
+     */
+    std::atomic<ui64> tasks_queued = 0;
+
     /**
      * @brief A queue of tasks to be executed by the threads.
      */
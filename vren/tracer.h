@@ -1,19 +1,49 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include "vec3.h"
 #include "ray.h"
 #include "tracer_callback.h"
 #include "rawdata.h"
+#include "stats.h"
+#include "render_job.h"
 
 class tracer {
 public:
     virtual void Render(unsigned spp, bool parallel = true, callback::callback* cb = nullptr) {}
 
+    // starts a pass and returns right away, the returned job reports its progress and cancels it
+    // tracers that can't render in the background complete the pass before returning
+    virtual std::shared_ptr<render_job> RenderAsync(unsigned spp, bool parallel = true, callback::callback* cb = nullptr) {
+        Render(spp, parallel, cb);
+        auto job = std::make_shared<render_job>(std::vector<render_tile>{});
+        job->Finish();
+        return job;
+    }
+
     virtual void DebugPixel(unsigned x, unsigned y, unsigned spp, callback::callback* cb) = 0;
 
     virtual void updateCamera(double from_x, double from_y, double from_z,
         double at_x, double at_y, double at_z) = 0;
     // keep camera as is but resets rendering back to iteration 0
     virtual void Reset() = 0;
+
+    // when size > 1 passes render one sample per size x size block of pixels, for interactive previews
+    // the film should be Reset() when going back to full resolution
+    virtual void SetPreview(int size) {}
+
+    // film pixels [x0, x1) x [y0, y1) that RenderAsync() renders first, with boost times more samples than the rest
+    // of the film. An empty rectangle renders the film uniformly
+    virtual void SetFocus(int x0, int y0, int x1, int y1, unsigned boost) {}
+
+    // when enabled, updateCamera() moves the samples that are still visible to their new pixels instead of resetting
+    // the film, for interactive navigation
+    virtual void SetReprojection(bool enabled) {}
+
+    // paths and rays traced since the last Reset()
+    virtual render_stats GetStats() const { return {}; }
+
+    // threads that render a parallel pass
+    virtual unsigned GetThreadCount() const { return 1; }
 };
\ No newline at end of file
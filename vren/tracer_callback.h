@@ -102,8 +102,6 @@ namespace callback {
     };
 
     class MediumSkip : public Skip {
-    private:
-        const std::string reason;
     public:
         MediumSkip(std::string reason) : Skip("medium"), reason(reason) {}
 
@@ -112,6 +110,8 @@ namespace callback {
         }
 
         static event_ptr make(std::string reason) { return std::make_shared<MediumSkip>(reason); }
+
+        const std::string reason;
     };
 
     class Bounce: public Event {